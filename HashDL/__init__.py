@@ -1,5 +1,6 @@
 from .hashdl import (SGD, Adam,
-                     WTA, DWTA,
+                     WTA, DWTA, SRP, DOPH,
+                     MapTable, BucketArray,
                      ConstantFrequency, ExponentialDecay,
                      Linear, ReLU, Sigmoid,
                      ConstantInitializer, GaussInitializer,
@@ -13,25 +13,26 @@ namespace HashDL {
     Activation& operator=(Activation&&) = default;
     virtual ~Activation() = default;
 
+    // Derived classes are final, so that calls through them are inlined.
     virtual T call(T x) const = 0;
     virtual T back(T y, T dL_dy) const = 0;
   };
 
-  template<typename T> class Linear : public Activation<T> {
+  template<typename T> class Linear final : public Activation<T> {
   public:
     T call(T x) const override { return x; }
     T back(T /* y */, T dL_dy) const override { return dL_dy; }
   };
 
-  template<typename T> class ReLU : public Activation<T> {
+  template<typename T> class ReLU final : public Activation<T> {
   public:
     T call(T x) const override { return (x>0)? x: 0; }
     T back(T y, T dL_dy) const override {  return (y>0)? dL_dy: 0; }
   };
 
-  template<typename T> class Sigmoid : public Activation<T> {
+  template<typename T> class Sigmoid final : public Activation<T> {
   public:
-    T call(T x) const override { return 1.0/(1.0 + std::exp(-x)); }
+    T call(T x) const override { return T{1}/(T{1} + std::exp(-x)); }
     T back(T y, T dL_dy) const override { return y*(1-y)*dL_dy; }
   };
 }
@@ -2,8 +2,15 @@
 #define DATA_HH
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <span>
 #include <vector>
 #include <iterator>
+#include <memory>
+
+#include <tbb/enumerable_thread_specific.h>
 
 namespace HashDL {
   using hashcode_t = std::uint64_t;
@@ -19,6 +26,113 @@ namespace HashDL {
   }
 
 
+  template<typename T, std::size_t Align = 64> class AlignedAllocator {
+  public:
+    using value_type = T;
+    template<typename U> struct rebind { using other = AlignedAllocator<U, Align>; };
+
+    AlignedAllocator() = default;
+    template<typename U> AlignedAllocator(const AlignedAllocator<U, Align>&) noexcept {}
+
+    T* allocate(std::size_t n){
+      return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{Align}));
+    }
+    void deallocate(T* p, std::size_t){
+      ::operator delete(p, std::align_val_t{Align});
+    }
+
+    template<typename U> bool operator==(const AlignedAllocator<U, Align>&) const noexcept {
+      return true;
+    }
+    template<typename U> bool operator!=(const AlignedAllocator<U, Align>&) const noexcept {
+      return false;
+    }
+  };
+
+  // Cache line aligned contiguous storage
+  template<typename T> using aligned_vector = std::vector<T, AlignedAllocator<T>>;
+
+  // Round up row length so that every row starts at cache line boundary
+  template<typename T> inline constexpr std::size_t aligned_stride(std::size_t N){
+    constexpr std::size_t line = std::max<std::size_t>(64 / sizeof(T), 1);
+    return (N + line - 1) / line * line;
+  }
+
+
+  // Set of indices in [0, N) which can be filled concurrently.
+  // Clearing costs O(inserted), not O(N).
+  class IndexSet {
+  private:
+    std::vector<std::uint8_t> flag;
+    idx_t list;
+    std::size_t count;
+    bool all;
+  public:
+    IndexSet(): IndexSet{0} {}
+    IndexSet(std::size_t N): flag(N, 0), list(N), count{0}, all{false} {}
+    IndexSet(const IndexSet&) = default;
+    IndexSet(IndexSet&&) = default;
+    IndexSet& operator=(const IndexSet&) = default;
+    IndexSet& operator=(IndexSet&&) = default;
+    ~IndexSet() = default;
+
+    // Thread safe
+    void insert(std::size_t i){
+      auto f = std::atomic_ref<std::uint8_t>{flag[i]};
+      if(!f.load(std::memory_order_relaxed) && !f.exchange(1)){
+	list[std::atomic_ref<std::size_t>{count}.fetch_add(1)] = i;
+      }
+    }
+    void insert_all() noexcept { std::atomic_ref<bool>{all}.store(true); }
+
+    bool contains(std::size_t i) const noexcept { return all || flag[i]; }
+    bool full() const noexcept { return all || (count == flag.size()); }
+    std::size_t size() const noexcept { return all ? flag.size(): count; }
+    std::size_t capacity() const noexcept { return flag.size(); }
+
+    // Inserted indices (unordered). Not valid when insert_all() is called.
+    std::span<const std::size_t> indices() const noexcept { return {list.data(), count}; }
+
+    void clear() noexcept {
+      for(std::size_t i=0; i<count; ++i){ flag[list[i]] = 0; }
+      count = 0;
+      all = false;
+    }
+  };
+
+
+  // Lazily constructed instance of V for each thread.
+  // Lookup is lock free (tbb::enumerable_thread_specific), so that hot path
+  // can call local() without contention.
+  template<typename V> class PerThread {
+  private:
+    tbb::enumerable_thread_specific<std::unique_ptr<V>> data;
+  public:
+    PerThread(): data{} {}
+    PerThread(const PerThread&) = delete;
+    PerThread(PerThread&&) = default;
+    PerThread& operator=(const PerThread&) = delete;
+    PerThread& operator=(PerThread&&) = default;
+    ~PerThread() = default;
+
+    // Thread safe. make() is called only at the first access from a thread.
+    template<typename F> V& local(F&& make){
+      auto& v = data.local();
+      if(!v){ v.reset(new V{make()}); }
+      return *v;
+    }
+
+    // Not thread safe. Must not be called concurrently with local().
+    template<typename F> void for_each(F&& f){
+      for(auto& v : data){
+	if(v){ f(*v); }
+      }
+    }
+
+    std::size_t size() const noexcept { return data.size(); }
+  };
+
+
   template<typename T> class Data {
   private:
     std::size_t _size;
@@ -29,9 +143,9 @@ namespace HashDL {
     Data(std::size_t size): _size{size}, data(size) {}
     Data(const std::vector<T>& data): _size{data.size()}, data{data} {}
     Data(std::vector<T>&& data): _size{data.size()}, data{data} {}
-    template<typename I> Data(I&& begin, I&& end)
+    template<typename I> Data(I begin, I end)
       : _size{(std::size_t)std::distance(begin, end)}, data{begin, end} {}
-    template<typename I, typename F> Data<T>(I&& begin, I&& end, F&& f)
+    template<typename I, typename F> Data(I begin, I end, F&& f)
       : _size{(std::size_t)std::distance(begin, end)}, data{}
     {
       data.reserve(_size);
@@ -44,6 +158,15 @@ namespace HashDL {
     ~Data() = default;
 
     std::size_t size() const noexcept { return _size; }
+    // Reuse allocated memory when capacity is enough
+    template<typename I> void assign(I begin, I end){
+      data.assign(begin, end);
+      _size = data.size();
+    }
+    void assign(std::size_t size, T v){
+      data.assign(size, v);
+      _size = size;
+    }
     auto begin(){ return data.begin(); }
     auto end(){ return data.end(); }
     const auto begin() const { return data.begin(); }
@@ -128,6 +251,64 @@ namespace HashDL {
     auto get_data_size() const noexcept { return data_size; }
     auto get_batch_size() const noexcept { return batch_size; }
   };
+
+
+  // Non-owning view of CSR (Compressed Sparse Row) batch.
+  // Nonzeros of row i are indices[indptr[i]:indptr[i+1]] and aligned values.
+  template<typename T> class CSRView {
+  private:
+    std::size_t data_size;
+    std::size_t batch_size;
+    const std::size_t* indptr;
+    const std::size_t* index_ptr;
+    const T* value_ptr;
+  public:
+    CSRView() = default;
+    CSRView(std::size_t data_size, std::size_t batch_size,
+	    const std::size_t* indptr, const std::size_t* indices, const T* values)
+      : data_size{data_size}, batch_size{batch_size},
+	indptr{indptr}, index_ptr{indices}, value_ptr{values} {}
+    CSRView(const CSRView&) = default;
+    CSRView(CSRView&&) = default;
+    CSRView& operator=(const CSRView&) = default;
+    CSRView& operator=(CSRView&&) = default;
+    ~CSRView() = default;
+
+    std::span<const std::size_t> indices(std::size_t i) const {
+      return {index_ptr + indptr[i], index_ptr + indptr[i+1]};
+    }
+    std::span<const T> values(std::size_t i) const {
+      return {value_ptr + indptr[i], value_ptr + indptr[i+1]};
+    }
+
+    auto get_data_size() const noexcept { return data_size; }
+    auto get_batch_size() const noexcept { return batch_size; }
+  };
+
+
+  // Non-owning view of class labels of batch in CSR format without values.
+  // Labels of sample i are indices[indptr[i]:indptr[i+1]].
+  class LabelView {
+  private:
+    std::size_t batch_size;
+    const std::size_t* indptr;
+    const std::size_t* index_ptr;
+  public:
+    LabelView() = default;
+    LabelView(std::size_t batch_size, const std::size_t* indptr, const std::size_t* indices)
+      : batch_size{batch_size}, indptr{indptr}, index_ptr{indices} {}
+    LabelView(const LabelView&) = default;
+    LabelView(LabelView&&) = default;
+    LabelView& operator=(const LabelView&) = default;
+    LabelView& operator=(LabelView&&) = default;
+    ~LabelView() = default;
+
+    std::span<const std::size_t> indices(std::size_t i) const {
+      return {index_ptr + indptr[i], index_ptr + indptr[i+1]};
+    }
+
+    auto get_batch_size() const noexcept { return batch_size; }
+  };
 }
 
 #endif
@@ -4,16 +4,23 @@
 #include <cstdint>
 #include <cmath>
 #include <algorithm>
+#include <array>
 #include <functional>
 #include <iterator>
 #include <limits>
 #include <memory>
 #include <numeric>
 #include <random>
+#include <span>
 #include <stdexcept>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
 #include "data.hh"
 
 namespace HashDL {
@@ -28,6 +35,339 @@ namespace HashDL {
     using Data_t = Data<T>;
 
     virtual hashcode_t encode(const Data_t& data) = 0;
+
+    // Encode a single vector without size check nor heap allocation
+    virtual hashcode_t encode(const T* x) = 0;
+
+    // Encode every row of row-major matrix X [rows, stride] into codes [rows]
+    // (Default: row by row)
+    virtual void encode(const T* X, std::size_t rows, std::size_t stride,
+			hashcode_t* codes){
+      for(std::size_t n=0; n<rows; ++n){ codes[n] = encode(X + n * stride); }
+    }
+
+    // Encode neuron weight w, and every row of W [rows, stride].
+    // (Default: same as input)
+    virtual hashcode_t encode_weight(const T* w){ return encode(w); }
+    virtual void encode_weight(const T* W, std::size_t rows, std::size_t stride,
+			       hashcode_t* codes){
+      encode(W, rows, stride, codes);
+    }
+
+    // Number of largest magnitude weights, whose indices are encoded as a sparse
+    // set instead of the whole weight. (Default: 0, whole weight)
+    // Callers encoding many tables can select them once by top_support()
+    // and pass them to encode(idx, {}).
+    virtual std::size_t weight_support() const noexcept { return 0; }
+
+    // Encode sparse vector given by nonzero indices and their values.
+    virtual hashcode_t encode(std::span<const std::size_t> /* idx */,
+			      std::span<const T> /* value */){
+      throw std::runtime_error("Sparse input is not supported");
+    }
+    virtual bool sparse() const noexcept { return false; }
+
+    // Multi-probe. Write the code of x and up to n-1 neighbouring codes,
+    // and return the number of written codes. (Default: no neighbour)
+    virtual std::size_t probe(const T* x, std::size_t n, hashcode_t* codes){
+      if(n == 0){ return 0; }
+      codes[0] = encode(x);
+      return 1;
+    }
+
+    // Multi-probe of sparse vector. (Default: no neighbour)
+    virtual std::size_t probe(std::span<const std::size_t> idx, std::span<const T> value,
+			      std::size_t n, hashcode_t* codes){
+      if(n == 0){ return 0; }
+      codes[0] = encode(idx, value);
+      return 1;
+    }
+  };
+
+
+  // Random samples of WTA family, which finds max in every bin.
+  // theta is flattened and transposed to [sample_size, bin_stride],
+  // so that the indices of all bins at a sample position are contiguous
+  // and can be gathered at once.
+  template<typename T> class WTASampler {
+  public:
+    // bin_size * sample_bits <= 64 bits hash code limits bin_size to 64,
+    // so that fixed size scratch on stack is enough.
+    static constexpr const std::size_t capacity = 64;
+    struct Scratch {
+      alignas(64) std::array<T, capacity> max_v;
+      alignas(64) std::array<std::int32_t, capacity> max_i;
+    };
+
+    // Rows per block of batched max(), which share index loads.
+    static constexpr const std::size_t block = 4;
+    struct BlockScratch {
+      alignas(64) std::array<T, block * capacity> max_v;
+      alignas(64) std::array<std::int32_t, block * capacity> max_i;
+    };
+  private:
+    std::size_t _bin_size;
+    std::size_t _sample_size;
+    std::size_t _bin_stride; // bin_size padded to SIMD lanes
+    std::vector<std::int32_t> theta;
+
+    // Narrow bins waste half of 512bit gather, so that 256bit is used.
+    static std::size_t lanes([[maybe_unused]] std::size_t bin_size) noexcept {
+#if defined(__AVX512F__)
+      return (bin_size > 8) ? 16: 8;
+#elif defined(__AVX2__)
+      return 8;
+#else
+      return 1;
+#endif
+    }
+
+#if defined(__AVX512F__)
+    void max_avx512(const float* x, float* max_v, std::int32_t* max_i) const {
+      for(std::size_t b=0; b<_bin_stride; b+=16){
+	auto mv = _mm512_set1_ps(std::numeric_limits<float>::lowest());
+	auto mi = _mm512_setzero_si512();
+	for(std::size_t i=0; i<_sample_size; ++i){
+	  const auto idx = _mm512_loadu_si512(theta.data() + i * _bin_stride + b);
+	  const auto v = _mm512_mask_i32gather_ps(mv, 0xFFFF, idx, x, sizeof(float));
+	  const auto gt = _mm512_cmp_ps_mask(v, mv, _CMP_GT_OQ);
+	  mv = _mm512_mask_blend_ps(gt, mv, v);
+	  mi = _mm512_mask_blend_epi32(gt, mi, _mm512_set1_epi32(i));
+	}
+	_mm512_storeu_ps(max_v + b, mv);
+	_mm512_storeu_si512(max_i + b, mi);
+      }
+    }
+#endif
+
+#if defined(__AVX2__)
+    void max_avx2(const float* x, float* max_v, std::int32_t* max_i) const {
+      for(std::size_t b=0; b<_bin_stride; b+=8){
+	auto mv = _mm256_set1_ps(std::numeric_limits<float>::lowest());
+	auto mi = _mm256_setzero_si256();
+	for(std::size_t i=0; i<_sample_size; ++i){
+	  const auto idx =
+	    _mm256_loadu_si256((const __m256i*)(theta.data() + i * _bin_stride + b));
+	  const auto v = _mm256_i32gather_ps(x, idx, sizeof(float));
+	  const auto gt = _mm256_cmp_ps(v, mv, _CMP_GT_OQ);
+	  mv = _mm256_blendv_ps(mv, v, gt);
+	  mi = _mm256_blendv_epi8(mi, _mm256_set1_epi32(i), _mm256_castps_si256(gt));
+	}
+	_mm256_storeu_ps(max_v + b, mv);
+	_mm256_storeu_si256((__m256i*)(max_i + b), mi);
+      }
+    }
+#endif
+
+#if defined(__AVX512F__)
+    // Rows rows of X at once, which share index loads and
+    // have independent gather and compare chains.
+    template<std::size_t Rows>
+    void max_rows_avx512(const float* X, std::size_t stride,
+			 float* max_v, std::int32_t* max_i) const {
+      for(std::size_t b=0; b<_bin_stride; b+=16){
+	__m512 mv[Rows];
+	__m512i mi[Rows];
+	for(std::size_t r=0; r<Rows; ++r){
+	  mv[r] = _mm512_set1_ps(std::numeric_limits<float>::lowest());
+	  mi[r] = _mm512_setzero_si512();
+	}
+	for(std::size_t i=0; i<_sample_size; ++i){
+	  const auto idx = _mm512_loadu_si512(theta.data() + i * _bin_stride + b);
+	  const auto s = _mm512_set1_epi32(i);
+	  for(std::size_t r=0; r<Rows; ++r){
+	    const auto v = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, idx,
+						    X + r * stride, sizeof(float));
+	    const auto gt = _mm512_cmp_ps_mask(v, mv[r], _CMP_GT_OQ);
+	    mv[r] = _mm512_mask_blend_ps(gt, mv[r], v);
+	    mi[r] = _mm512_mask_blend_epi32(gt, mi[r], s);
+	  }
+	}
+	for(std::size_t r=0; r<Rows; ++r){
+	  _mm512_storeu_ps(max_v + r * _bin_stride + b, mv[r]);
+	  _mm512_storeu_si512(max_i + r * _bin_stride + b, mi[r]);
+	}
+      }
+    }
+#endif
+
+#if defined(__AVX2__)
+    template<std::size_t Rows>
+    void max_rows_avx2(const float* X, std::size_t stride,
+		       float* max_v, std::int32_t* max_i) const {
+      for(std::size_t b=0; b<_bin_stride; b+=8){
+	__m256 mv[Rows];
+	__m256i mi[Rows];
+	for(std::size_t r=0; r<Rows; ++r){
+	  mv[r] = _mm256_set1_ps(std::numeric_limits<float>::lowest());
+	  mi[r] = _mm256_setzero_si256();
+	}
+	for(std::size_t i=0; i<_sample_size; ++i){
+	  const auto idx =
+	    _mm256_loadu_si256((const __m256i*)(theta.data() + i * _bin_stride + b));
+	  const auto s = _mm256_set1_epi32(i);
+	  for(std::size_t r=0; r<Rows; ++r){
+	    const auto v = _mm256_i32gather_ps(X + r * stride, idx, sizeof(float));
+	    const auto gt = _mm256_cmp_ps(v, mv[r], _CMP_GT_OQ);
+	    mv[r] = _mm256_blendv_ps(mv[r], v, gt);
+	    mi[r] = _mm256_blendv_epi8(mi[r], s, _mm256_castps_si256(gt));
+	  }
+	}
+	for(std::size_t r=0; r<Rows; ++r){
+	  _mm256_storeu_ps(max_v + r * _bin_stride + b, mv[r]);
+	  _mm256_storeu_si256((__m256i*)(max_i + r * _bin_stride + b), mi[r]);
+	}
+      }
+    }
+#endif
+  public:
+    WTASampler() = default;
+    template<typename G>
+    WTASampler(std::size_t bin_size, std::size_t data_size, std::size_t sample_size,
+	       G& generator)
+      : _bin_size{bin_size},
+	_sample_size{sample_size},
+	_bin_stride{(bin_size + lanes(bin_size) - 1) / lanes(bin_size) * lanes(bin_size)},
+	theta(sample_size * _bin_stride, 0)
+    {
+      if(bin_size > capacity){
+	throw std::runtime_error("bin_size is too large");
+      }
+      if(data_size > std::size_t(std::numeric_limits<std::int32_t>::max())){
+	throw std::runtime_error("data_size is too large");
+      }
+
+      std::vector<std::int32_t> index(data_size);
+      std::iota(index.begin(), index.end(), 0);
+
+      for(std::size_t b=0; b<bin_size; ++b){
+	std::shuffle(index.begin(), index.end(), generator);
+	for(std::size_t i=0; i<sample_size; ++i){
+	  theta[i * _bin_stride + b] = index[i];
+	}
+      }
+    }
+    WTASampler(const WTASampler&) = default;
+    WTASampler(WTASampler&&) = default;
+    WTASampler& operator=(const WTASampler&) = default;
+    WTASampler& operator=(WTASampler&&) = default;
+    ~WTASampler() = default;
+
+    auto bin_size() const noexcept { return _bin_size; }
+    auto sample_size() const noexcept { return _sample_size; }
+    auto bin_stride() const noexcept { return _bin_stride; }
+
+    void max(const T* x, Scratch& s) const { max(x, s.max_v.data(), s.max_i.data()); }
+
+    // Max value (max_v) and its sample position (max_i) of each bin.
+    // max_v and max_i must have bin_stride() elements.
+    void max(const T* x, T* max_v, std::int32_t* max_i) const {
+      if constexpr (std::is_same_v<T, float>){
+#if defined(__AVX512F__)
+	if(_bin_stride % 16 == 0){ return max_avx512(x, max_v, max_i); }
+#endif
+#if defined(__AVX2__)
+	return max_avx2(x, max_v, max_i);
+#endif
+      }
+      max_scalar(x, max_v, max_i);
+    }
+
+    // max() of every row of X [rows, stride] into max_v and max_i [rows, bin_stride()].
+    // Every block of rows shares index loads, and the rest runs row by row.
+    void max(const T* X, std::size_t rows, std::size_t stride,
+	     T* max_v, std::int32_t* max_i) const {
+      constexpr auto R = block;
+      std::size_t n = 0;
+      if constexpr (std::is_same_v<T, float>){
+#if defined(__AVX512F__)
+	if(_bin_stride % 16 == 0){
+	  for(; n+R<=rows; n+=R){
+	    max_rows_avx512<R>(X + n * stride, stride,
+			       max_v + n * _bin_stride, max_i + n * _bin_stride);
+	  }
+	}
+#endif
+#if defined(__AVX2__)
+	for(; n+R<=rows; n+=R){
+	  max_rows_avx2<R>(X + n * stride, stride,
+			   max_v + n * _bin_stride, max_i + n * _bin_stride);
+	}
+#endif
+      }
+      for(; n<rows; ++n){
+	max(X + n * stride, max_v + n * _bin_stride, max_i + n * _bin_stride);
+      }
+    }
+
+    // Portable implementation
+    void max_scalar(const T* x, T* max_v, std::int32_t* max_i) const {
+      for(std::size_t b=0; b<_bin_size; ++b){
+	auto mv = std::numeric_limits<T>::lowest();
+	std::int32_t mi = 0;
+	for(std::size_t i=0; i<_sample_size; ++i){
+	  if(const auto v = x[theta[i * _bin_stride + b]]; v > mv){ mv = v; mi = i; }
+	}
+	max_v[b] = mv;
+	max_i[b] = mi;
+      }
+    }
+
+    // Max and runner-up of each bin. (second.max_i is -1 without runner-up)
+    void max2(const T* x, Scratch& first, Scratch& second) const {
+      for(std::size_t b=0; b<_bin_size; ++b){
+	auto m1 = x[theta[b]], m2 = std::numeric_limits<T>::lowest();
+	std::int32_t i1 = 0, i2 = -1;
+	for(std::size_t i=1; i<_sample_size; ++i){
+	  if(const auto v = x[theta[i * _bin_stride + b]]; v > m1){
+	    m2 = m1; i2 = i1;
+	    m1 = v; i1 = i;
+	  } else if(v > m2){
+	    m2 = v; i2 = i;
+	  }
+	}
+	first.max_v[b] = m1;
+	first.max_i[b] = i1;
+	second.max_v[b] = m2;
+	second.max_i[b] = i2;
+      }
+    }
+
+    // Multi-probe codes. codes[0] is the code of x, and codes[1, n) are
+    // made by replacing max of a bin with its runner-up, in ascending
+    // order of their gap. Return the number of distinct codes.
+    template<typename F>
+    std::size_t probe(const T* x, std::size_t n, hashcode_t* codes, F&& combine) const {
+      Scratch first, second;
+      max2(x, first, second);
+      codes[0] = combine(first);
+      if(n <= 1){ return 1; }
+
+      std::array<std::uint8_t, capacity> bins;
+      std::size_t nbins = 0;
+      for(std::size_t b=0; b<_bin_size; ++b){
+	if(second.max_i[b] >= 0){ bins[nbins++] = b; }
+      }
+      const auto gap = [&](auto b){ return first.max_v[b] - second.max_v[b]; };
+      const auto k = std::min(nbins, n - 1);
+      std::partial_sort(bins.begin(), bins.begin() + k, bins.begin() + nbins,
+			[&](auto a, auto b){ return gap(a) < gap(b); });
+
+      std::size_t m = 1;
+      for(std::size_t j=0; j<k; ++j){
+	const auto b = bins[j];
+	std::swap(first.max_v[b], second.max_v[b]);
+	std::swap(first.max_i[b], second.max_i[b]);
+
+	const auto c = combine(first);
+	if(std::find(codes, codes + m, c) == codes + m){ codes[m++] = c; }
+
+	std::swap(first.max_v[b], second.max_v[b]);
+	std::swap(first.max_i[b], second.max_i[b]);
+      }
+
+      return m;
+    }
   };
 
 
@@ -37,7 +377,15 @@ namespace HashDL {
     const std::size_t data_size;
     const std::size_t sample_size;
     std::size_t sample_bits;
-    std::vector<std::vector<std::size_t>> theta; // [bin_size, sample_size]
+    WTASampler<T> sampler;
+
+    hashcode_t combine(const std::int32_t* max_i) const noexcept {
+      hashcode_t hash = 0;
+      for(std::size_t b=0; b<bin_size; ++b){
+	hash = (hash << sample_bits) | hashcode_t(max_i[b]);
+      }
+      return hash;
+    }
   public:
     WTA(): WTA{8, 16, 4} {}
     WTA(std::size_t bin_size, std::size_t data_size, std::size_t sample_size)
@@ -45,7 +393,7 @@ namespace HashDL {
 	data_size{data_size},
 	sample_size{sample_size},
 	sample_bits{1},
-	theta{}
+	sampler{}
     {
       if(data_size < sample_size){
 	throw std::runtime_error("sample_size must be smaller than data_size");
@@ -62,17 +410,8 @@ namespace HashDL {
 				 "for 64bit hash code");
       }
 
-      std::vector<std::size_t> index{};
-      index.reserve(data_size);
-      std::generate_n(std::back_inserter(index), data_size,
-		      [i=0]() mutable { return i++; });
-
       std::mt19937 generator{std::random_device{}()};
-      theta.reserve(bin_size);
-      for(std::size_t i=0; i<bin_size; ++i){
-	std::shuffle(index.begin(), index.end(), generator);
-	theta.emplace_back(index.begin(), index.begin()+sample_size);
-      }
+      sampler = WTASampler<T>{bin_size, data_size, sample_size, generator};
     }
     WTA(const WTA&) = default;
     WTA(WTA&&) = default;
@@ -83,19 +422,31 @@ namespace HashDL {
 
     hashcode_t encode(const Data_t& data) override {
       if(data.size() != data_size){ throw std::runtime_error("Data size mismuch!"); }
-      hashcode_t hash = 0;
+      return encode(std::to_address(data.begin()));
+    }
 
-      for(const auto& th : theta){
-	auto max_v = std::numeric_limits<T>::lowest();
-	std::size_t max_i = 0;
-	for(std::size_t i=0; i<sample_size; ++i){
-	  if(const auto v = data[th[i]]; v > max_v){ max_v = v; max_i = i; }
-	}
+    hashcode_t encode(const T* x) override {
+      typename WTASampler<T>::Scratch s;
+      sampler.max(x, s);
+      return combine(s.max_i.data());
+    }
 
-	hash = (hash << sample_bits) | hashcode_t{max_i};
+    void encode(const T* X, std::size_t rows, std::size_t stride,
+		hashcode_t* codes) override {
+      constexpr auto block = WTASampler<T>::block;
+      const auto bs = sampler.bin_stride();
+      typename WTASampler<T>::BlockScratch s;
+      for(std::size_t n=0; n<rows; n+=block){
+	const auto m = std::min(block, rows - n);
+	sampler.max(X + n * stride, m, stride, s.max_v.data(), s.max_i.data());
+	for(std::size_t r=0; r<m; ++r){ codes[n + r] = combine(s.max_i.data() + r * bs); }
       }
+    }
 
-      return hash;
+    std::size_t probe(const T* x, std::size_t n, hashcode_t* codes) override {
+      if(n == 0){ return 0; }
+      return sampler.probe(x, n, codes,
+			   [this](auto& s){ return combine(s.max_i.data()); });
     }
   };
 
@@ -108,8 +459,28 @@ namespace HashDL {
     std::size_t sample_bits;
     const std::size_t max_attempt;
     std::size_t attempt_bits;
-    std::vector<std::vector<std::size_t>> theta; // [bin_size, sample_size]
+    WTASampler<T> sampler;
     std::size_t coprime;
+
+    hashcode_t combine(const T* max_v, const std::int32_t* max_i) const noexcept {
+      hashcode_t hash = 0;
+      for(std::size_t b=0; b<bin_size; ++b){
+	if(max_v[b]){ // != 0.0
+	  hash = (hash << sample_bits) | hashcode_t(max_i[b]);
+	}else{ // == 0.0
+	  std::size_t next = b;
+	  for(std::size_t attempt=0; attempt<max_attempt; ++attempt){
+	    next = universal_hash(b, attempt);
+	    if(max_v[next]){ break; }
+	  }
+	  // Original DWTA adds "attempt + C", however, SLIDE doesn't.
+	  // http://auai.org/uai2018/proceedings/papers/321.pdf
+	  hash = (hash << sample_bits) | hashcode_t(max_i[next]);
+	}
+      }
+
+      return hash;
+    }
   public:
     DWTA() : DWTA{8, 16, 4} {}
     DWTA(std::size_t bin_size, std::size_t data_size, std::size_t sample_size,
@@ -120,7 +491,7 @@ namespace HashDL {
 	sample_bits{1},
 	max_attempt{max_attempt},
 	attempt_bits{1},
-	theta{},
+	sampler{},
 	coprime{}
     {
       if(data_size < sample_size){
@@ -144,21 +515,12 @@ namespace HashDL {
 				 "for 64bit hash code");
       }
 
-      std::vector<std::size_t> index{};
-      index.reserve(data_size);
-      std::generate_n(std::back_inserter(index), data_size,
-		      [i=0]() mutable { return i++; });
-
       std::mt19937 generator{std::random_device{}()};
-      theta.reserve(bin_size);
-      for(std::size_t i=0; i<bin_size; ++i){
-	std::shuffle(index.begin(), index.end(), generator);
-	theta.emplace_back(index.begin(), index.begin()+sample_size);
-      }
+      sampler = WTASampler<T>{bin_size, data_size, sample_size, generator};
 
       std::uniform_int_distribution<std::size_t> dist(0, std::numeric_limits<std::size_t>::max());
       coprime = dist(generator);
-      while(std::gcd(sample_size, coprime) != 1){ coprime = dist(generator); }
+      while(std::gcd(bin_size, coprime) != 1){ coprime = dist(generator); }
     }
     DWTA(const DWTA&) = default;
     DWTA(DWTA&&) = default;
@@ -169,46 +531,318 @@ namespace HashDL {
 
     hashcode_t encode(const Data_t& data) override {
       if(data.size() != data_size){ throw std::runtime_error("Data size mismuch!"); }
+      return encode(std::to_address(data.begin()));
+    }
 
-      std::vector<T> max_vs{};
-      max_vs.reserve(sample_size);
+    hashcode_t encode(const T* x) override {
+      typename WTASampler<T>::Scratch s;
+      sampler.max(x, s);
+      return combine(s.max_v.data(), s.max_i.data());
+    }
 
-      std::vector<std::size_t> max_is{};
-      max_is.reserve(sample_size);
+    void encode(const T* X, std::size_t rows, std::size_t stride,
+		hashcode_t* codes) override {
+      constexpr auto block = WTASampler<T>::block;
+      const auto bs = sampler.bin_stride();
+      typename WTASampler<T>::BlockScratch s;
+      for(std::size_t n=0; n<rows; n+=block){
+	const auto m = std::min(block, rows - n);
+	sampler.max(X + n * stride, m, stride, s.max_v.data(), s.max_i.data());
+	for(std::size_t r=0; r<m; ++r){
+	  codes[n + r] = combine(s.max_v.data() + r * bs, s.max_i.data() + r * bs);
+	}
+      }
+    }
 
-      for(const auto& th : theta){
-	auto max_v = std::numeric_limits<T>::lowest();
-	std::size_t max_i = 0;
-	for(std::size_t i=0; i<sample_size; ++i){
-	  if(const auto v = data[th[i]]; v > max_v){ max_v = v; max_i = i; }
+    std::size_t probe(const T* x, std::size_t n, hashcode_t* codes) override {
+      if(n == 0){ return 0; }
+      return sampler.probe(x, n, codes,
+			   [this](auto& s){ return combine(s.max_v.data(), s.max_i.data()); });
+    }
+
+    // Densification probes other bins, so that the modulus is bin_size.
+    std::size_t universal_hash(std::size_t i, std::size_t attempt) const noexcept {
+      auto x = (i << attempt_bits) + attempt;
+      return (x * coprime) % bin_size;
+    }
+  };
+
+  // Signed random projection (SimHash) with very sparse +-1 projections.
+  // Each bit is the sign of the sum of nnz randomly signed elements.
+  template<typename T> class SRP : public Hash<T> {
+  private:
+    static constexpr const std::size_t capacity = 64;
+    const std::size_t bits;
+    const std::size_t data_size;
+    const std::size_t nnz;
+    std::vector<std::int32_t> index; // [bits, nnz]
+    std::vector<T> sign;             // [bits, nnz]
+
+    void project(const T* x, T* p) const noexcept {
+      for(std::size_t b=0; b<bits; ++b){
+	const auto idx = index.data() + b * nnz;
+	const auto sgn = sign.data() + b * nnz;
+	T sum = 0;
+	for(std::size_t i=0; i<nnz; ++i){ sum += sgn[i] * x[idx[i]]; }
+	p[b] = sum;
+      }
+    }
+
+    // project() of block rows of X into p [block, bits].
+    // The rows share index and sign loads, and have independent sums,
+    // which are accumulated in the same order as project().
+    static constexpr const std::size_t block = 4;
+    void project_rows(const T* X, std::size_t stride, T* p) const noexcept {
+      for(std::size_t b=0; b<bits; ++b){
+	const auto idx = index.data() + b * nnz;
+	const auto sgn = sign.data() + b * nnz;
+	std::array<T, block> sum{};
+	for(std::size_t i=0; i<nnz; ++i){
+	  const auto x = X + idx[i];
+	  for(std::size_t r=0; r<block; ++r){ sum[r] += sgn[i] * x[r * stride]; }
 	}
+	for(std::size_t r=0; r<block; ++r){ p[r * bits + b] = sum[r]; }
+      }
+    }
 
-	max_vs.push_back(max_v);
-	max_is.push_back(max_i);
+    hashcode_t combine(const T* p) const noexcept {
+      hashcode_t hash = 0;
+      for(std::size_t b=0; b<bits; ++b){ hash = (hash << 1) | hashcode_t(p[b] > 0); }
+      return hash;
+    }
+  public:
+    SRP(): SRP{16, 16, 4} {}
+    SRP(std::size_t bits, std::size_t data_size, std::size_t nnz)
+      : bits{bits},
+	data_size{data_size},
+	nnz{nnz},
+	index(bits * nnz),
+	sign(bits * nnz)
+    {
+      if(bits > capacity){
+	throw std::runtime_error("bits is too large for 64bit hash code");
+      }
+      if(data_size < nnz){
+	throw std::runtime_error("nnz must be smaller than data_size");
       }
+      if(data_size > std::size_t(std::numeric_limits<std::int32_t>::max())){
+	throw std::runtime_error("data_size is too large");
+      }
+
+      std::mt19937 generator{std::random_device{}()};
+      std::bernoulli_distribution coin{0.5};
+
+      std::vector<std::int32_t> all(data_size);
+      std::iota(all.begin(), all.end(), 0);
+      for(std::size_t b=0; b<bits; ++b){
+	std::sample(all.begin(), all.end(), index.begin() + b * nnz, nnz, generator);
+      }
+      std::generate(sign.begin(), sign.end(),
+		    [&](){ return coin(generator) ? T{1}: T{-1}; });
+    }
+    SRP(const SRP&) = default;
+    SRP(SRP&&) = default;
+    SRP& operator=(const SRP&) = default;
+    SRP& operator=(SRP&&) = default;
+    ~SRP() = default;
+    using Data_t = Data<T>;
+
+    hashcode_t encode(const Data_t& data) override {
+      if(data.size() != data_size){ throw std::runtime_error("Data size mismuch!"); }
+      return encode(std::to_address(data.begin()));
+    }
+
+    hashcode_t encode(const T* x) override {
+      std::array<T, capacity> p;
+      project(x, p.data());
+      return combine(p.data());
+    }
+
+    void encode(const T* X, std::size_t rows, std::size_t stride,
+		hashcode_t* codes) override {
+      std::array<T, block * capacity> p;
+      std::size_t n = 0;
+      for(; n+block<=rows; n+=block){
+	project_rows(X + n * stride, stride, p.data());
+	for(std::size_t r=0; r<block; ++r){ codes[n + r] = combine(p.data() + r * bits); }
+      }
+      for(; n<rows; ++n){ codes[n] = encode(X + n * stride); }
+    }
+
+    // Neighbours flip bits of the smallest |projection| first.
+    std::size_t probe(const T* x, std::size_t n, hashcode_t* codes) override {
+      if(n == 0){ return 0; }
+
+      std::array<T, capacity> p;
+      project(x, p.data());
+      codes[0] = combine(p.data());
+
+      std::array<std::uint8_t, capacity> order;
+      std::iota(order.begin(), order.begin() + bits, 0);
+      const auto k = std::min(bits, n - 1);
+      std::partial_sort(order.begin(), order.begin() + k, order.begin() + bits,
+			[&](auto a, auto b){ return std::abs(p[a]) < std::abs(p[b]); });
+
+      for(std::size_t j=0; j<k; ++j){
+	codes[j+1] = codes[0] ^ (hashcode_t{1} << (bits - 1 - order[j]));
+      }
+      return k + 1;
+    }
+  };
+
+  // Densified one permutation hashing (DOPH) of MinHash for sparse binary input.
+  // Nonzero indices are (pseudo-)permuted by a 64bit hash once, then
+  // split into bins, and min of each bin is taken at O(nnz).
+  // Empty bins borrow other bins (densification).
+  // No multi-probe neighbour is defined, so that probes have no effect.
+  //
+  // Dense weight has almost no zero, so that every neuron would be the same
+  // full set. A neuron is hashed as the set of its topk largest |w| (as SLIDE).
+  // Write indices of up to k largest magnitude nonzero elements of w [size]
+  // into support, and return their number. (Ties are broken by index.)
+  // order is scratch, which is resized to size.
+  template<typename T>
+  std::size_t top_support(const T* w, std::size_t size, std::size_t k,
+			  std::vector<std::uint32_t>& order, std::size_t* support){
+    k = std::min(k, size);
+    if(k == 0){ return 0; }
+
+    order.resize(size);
+    std::iota(order.begin(), order.end(), 0);
+    std::nth_element(order.begin(), order.begin() + (k - 1), order.end(),
+		     [w](auto a, auto b){
+		       const auto wa = std::abs(w[a]), wb = std::abs(w[b]);
+		       return (wa > wb) || ((wa == wb) && (a < b));
+		     });
+
+    std::size_t m = 0;
+    for(std::size_t j=0; j<k; ++j){
+      if(const auto i = order[j]; w[i]){ support[m++] = i; }
+    }
+    return m;
+  }
+
+
+  template<typename T> class DOPH : public Hash<T> {
+  private:
+    static constexpr const std::size_t capacity = 64;
+    static constexpr const std::uint32_t empty = std::numeric_limits<std::uint32_t>::max();
+    const std::size_t bin_size;
+    const std::size_t data_size;
+    const std::size_t bits;
+    const std::size_t max_attempt;
+    const std::size_t topk; // At most half of data_size, otherwise sets are too similar.
+    std::uint64_t seed;
+
+    struct Scratch {
+      std::vector<std::uint32_t> order;
+      std::vector<std::size_t> support;
+    };
+    std::shared_ptr<PerThread<Scratch>> scratch; // Shared by copies
+
+    // splitmix64
+    static std::uint64_t mix(std::uint64_t x) noexcept {
+      x += 0x9e3779b97f4a7c15;
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+      return x ^ (x >> 31);
+    }
+
+    void add(std::array<std::uint32_t, capacity>& m, std::size_t i) const noexcept {
+      const auto h = mix(i ^ seed);
+      const auto b = ((h >> 32) * bin_size) >> 32;
+      m[b] = std::min(m[b], std::uint32_t(h));
+    }
 
+    hashcode_t combine(const std::array<std::uint32_t, capacity>& m) const noexcept {
+      const auto mask = (hashcode_t{1} << bits) - 1;
       hashcode_t hash = 0;
-      for(std::size_t i=0; i<sample_size; ++i){
-	if(max_vs[i]){ // != 0.0
-	  hash = (hash << sample_bits) | hashcode_t{max_is[i]};
-	}else{ // == 0.0
-	  std::size_t next = i;
-	  for(std::size_t attempt=0; attempt<max_attempt; ++attempt){
-	    next = universal_hash(i, attempt);
-	    if(max_vs[next]){ break; }
-	  }
-	  // Original DWTA adds "attempt + C", however, SLIDE doesn't.
-	  // http://auai.org/uai2018/proceedings/papers/321.pdf
-	  hash = (hash << sample_bits) | hashcode_t{max_is[next]};
+      for(std::size_t b=0; b<bin_size; ++b){
+	auto v = m[b];
+	for(std::size_t attempt=0; (v == empty) && (attempt < max_attempt); ++attempt){
+	  v = m[mix(((b << 32) | attempt) ^ seed) % bin_size];
 	}
+	if(v == empty){ v = 0; }
+	hash = (hash << bits) | (v & mask);
       }
-
       return hash;
     }
 
-    std::size_t universal_hash(std::size_t i, std::size_t attempt){
-      auto x = (i << attempt_bits) + attempt;
-      return (x * coprime) % sample_size;
+  public:
+    DOPH(): DOPH{8, 16, 8} {}
+    DOPH(std::size_t bin_size, std::size_t data_size, std::size_t bits,
+	 std::size_t max_attempt=100, std::size_t topk=32)
+      : bin_size{bin_size},
+	data_size{data_size},
+	bits{bits},
+	max_attempt{max_attempt},
+	topk{std::max<std::size_t>(std::min(topk, data_size / 2), 1)},
+	seed{},
+	scratch{new PerThread<Scratch>{}}
+    {
+      if((bits == 0) || (bits > 32)){
+	throw std::runtime_error("bits must be in [1, 32]");
+      }
+      if(topk == 0){ throw std::runtime_error("topk must be positive"); }
+      if(data_size > std::size_t(std::numeric_limits<std::uint32_t>::max())){
+	throw std::runtime_error("data_size is too large");
+      }
+      if(bin_size*bits > 64){
+	throw std::runtime_error("bits and bin_size is too large "
+				 "for 64bit hash code");
+      }
+
+      std::mt19937_64 generator{std::random_device{}()};
+      seed = generator();
+    }
+    DOPH(const DOPH&) = default;
+    DOPH(DOPH&&) = default;
+    DOPH& operator=(const DOPH&) = default;
+    DOPH& operator=(DOPH&&) = default;
+    ~DOPH() = default;
+    using Data_t = Data<T>;
+
+    hashcode_t encode(const Data_t& data) override {
+      if(data.size() != data_size){ throw std::runtime_error("Data size mismuch!"); }
+      return encode(std::to_address(data.begin()));
+    }
+
+    // Nonzero elements of dense x are the set. (O(data_size))
+    hashcode_t encode(const T* x) override {
+      std::array<std::uint32_t, capacity> m;
+      m.fill(empty);
+      for(std::size_t i=0; i<data_size; ++i){
+	if(x[i]){ add(m, i); }
+      }
+      return combine(m);
+    }
+
+    // O(nnz). Values are ignored except for zero.
+    hashcode_t encode(std::span<const std::size_t> idx,
+		      std::span<const T> value) override {
+      std::array<std::uint32_t, capacity> m;
+      m.fill(empty);
+      for(std::size_t j=0; j<idx.size(); ++j){
+	if(value.empty() || value[j]){ add(m, idx[j]); }
+      }
+      return combine(m);
+    }
+    bool sparse() const noexcept override { return true; }
+
+    // Weight is hashed as the set of its top-k magnitude elements.
+    std::size_t weight_support() const noexcept override { return topk; }
+
+    hashcode_t encode_weight(const T* w) override {
+      auto& s = scratch->local([this](){
+	return Scratch{std::vector<std::uint32_t>(data_size), std::vector<std::size_t>(topk)};
+      });
+      const auto m = top_support(w, data_size, topk, s.order, s.support.data());
+      return encode(std::span<const std::size_t>{s.support.data(), m}, std::span<const T>{});
+    }
+
+    void encode_weight(const T* W, std::size_t rows, std::size_t stride,
+		       hashcode_t* codes) override {
+      for(std::size_t n=0; n<rows; ++n){ codes[n] = encode_weight(W + n * stride); }
     }
   };
 
@@ -262,5 +896,45 @@ namespace HashDL {
       return new DWTA<T>{bin_size, data_size, std::min(sample_size, data_size), max_attempt};
       }
     };
+
+  template<typename T> class SRPFunc : public HashFunc<T> {
+  private:
+    std::size_t bits;
+    std::size_t nnz;
+  public:
+    SRPFunc() = delete;
+    SRPFunc(std::size_t bits, std::size_t nnz): bits{bits}, nnz{nnz} {}
+    SRPFunc(const SRPFunc&) = default;
+    SRPFunc(SRPFunc&&) = default;
+    SRPFunc& operator=(const SRPFunc&) = default;
+    SRPFunc& operator=(SRPFunc&&) = default;
+    ~SRPFunc() = default;
+
+    Hash<T>* GetHash(std::size_t data_size) override {
+      return new SRP<T>{bits, data_size, std::min(nnz, data_size)};
+    }
+  };
+
+  template<typename T> class DOPHFunc : public HashFunc<T> {
+  private:
+    std::size_t bin_size;
+    std::size_t bits;
+    std::size_t max_attempt;
+    std::size_t topk;
+  public:
+    DOPHFunc() = delete;
+    DOPHFunc(std::size_t bin, std::size_t bits, std::size_t max = 100,
+	     std::size_t topk = 32)
+      : bin_size{bin}, bits{bits}, max_attempt{max}, topk{topk} {}
+    DOPHFunc(const DOPHFunc&) = default;
+    DOPHFunc(DOPHFunc&&) = default;
+    DOPHFunc& operator=(const DOPHFunc&) = default;
+    DOPHFunc& operator=(DOPHFunc&&) = default;
+    ~DOPHFunc() = default;
+
+    Hash<T>* GetHash(std::size_t data_size) override {
+      return new DOPH<T>{bin_size, data_size, bits, max_attempt, topk};
+    }
+  };
 }
 #endif
@@ -42,13 +42,16 @@ cdef class SGD(Optimizer):
 
 @cython.embedsignature(True)
 cdef class Adam(Optimizer):
-    def __cinit__(self, lr=1e-4, *args, **kwargs):
+    def __cinit__(self, lr=1e-4, *args, lazy=False, **kwargs):
         if lr < 0:
             raise ValueError(f"Learning Rate (lr) must be positive: {lr}")
 
-        self.opt = shared_ptr[slide.Optimizer[float]](<slide.Optimizer[float]*> new slide.Adam[float](lr))
+        cdef float beta1 = 0.9
+        cdef float beta2 = 0.999
+        cdef float eps = 1e-8
+        self.opt = shared_ptr[slide.Optimizer[float]](<slide.Optimizer[float]*> new slide.Adam[float](lr, beta1, beta2, eps, lazy))
 
-    def __init__(self, lr=1e-4, *args, **kwargs):
+    def __init__(self, lr=1e-4, *args, lazy=False, **kwargs):
         """
         Initialize Adam
 
@@ -56,6 +59,13 @@ cdef class Adam(Optimizer):
         ----------
         lr : float, optional
             Learning rate. The default is 1e-4
+        lazy : bool, optional
+            If `True`, moments of parameters without gradient are not
+            decayed at every step, but caught up when they are updated next.
+            With sparse update, rows which received gradient are updated
+            as a whole, so that their moments match dense Adam, while
+            skipped rows don't take momentum steps until they are updated.
+            The default is `False`
         """
         pass
 
@@ -106,6 +116,106 @@ cdef class DWTA(Hash):
         pass
 
 
+@cython.embedsignature(True)
+cdef class SRP(Hash):
+    def __cinit__(self, K_bits, nnz=4):
+        if not (0 < K_bits <= 64):
+            raise ValueError(f"K_bits must be in (0, 64]: {K_bits}")
+        self.hash = shared_ptr[slide.HashFunc[float]](<slide.HashFunc[float]*> new slide.SRPFunc[float](K_bits, nnz))
+
+    def __init__(self, K_bits, nnz=4):
+        """Initialize signed random projection (SimHash)
+
+        Parameters
+        ----------
+        K_bits : int
+            Number of bits (aka. projections) in single table.
+        nnz : int, optional
+            Number of nonzero +-1 elements in a projection. The default is `4`.
+        """
+        pass
+
+
+@cython.embedsignature(True)
+cdef class DOPH(Hash):
+    def __cinit__(self, K_hashes, bits=8, max_attempt=100, topk=32):
+        if not (0 < bits <= 32):
+            raise ValueError(f"bits must be in (0, 32]: {bits}")
+        if topk <= 0:
+            raise ValueError(f"topk must be positive: {topk}")
+        self.hash = shared_ptr[slide.HashFunc[float]](<slide.HashFunc[float]*> new slide.DOPHFunc[float](K_hashes, bits, max_attempt, topk))
+
+    def __init__(self, K_hashes, bits=8, max_attempt=100, topk=32):
+        """Initialize densified one permutation MinHash
+
+        Nonzero indices of input are hashed at O(nnz),
+        independent from input dimension. Dense neuron weight is hashed
+        as the set of its `topk` largest absolute values.
+
+        Parameters
+        ----------
+        K_hashes : int
+            Number of bins (aka. MinHash) in single table.
+        bits : int, optional
+            Number of lower bits of a MinHash used for hash code.
+            The default is `8`.
+        max_attempt : int, optional
+           Number of attempt to densification trial
+        topk : int, optional
+            Number of the largest absolute weights of a neuron used as its set.
+            It is limited to half of input dimension. The default is `32`.
+        """
+        pass
+
+
+cdef class Table:
+    cdef shared_ptr[slide.TableFunc] table
+
+    cdef shared_ptr[slide.TableFunc] ptr(self):
+        return self.table
+
+
+@cython.embedsignature(True)
+cdef class MapTable(Table):
+    def __cinit__(self):
+        self.table = shared_ptr[slide.TableFunc](<slide.TableFunc*> new slide.MapTableFunc())
+
+    def __init__(self):
+        """Initialize unbounded LSH table, which keeps all neurons
+        """
+        pass
+
+
+@cython.embedsignature(True)
+cdef class BucketArray(Table):
+    def __cinit__(self, bits = 10, capacity = 128, overflow = "fifo"):
+        if overflow not in ("fifo", "reservoir"):
+            raise ValueError(f"overflow must be 'fifo' or 'reservoir': {overflow}")
+
+        cdef slide.Overflow policy = slide.OverflowFIFO
+        if overflow == "reservoir":
+            policy = slide.OverflowReservoir
+
+        self.table = shared_ptr[slide.TableFunc](<slide.TableFunc*> new slide.BucketArrayFunc(bits, capacity, policy))
+
+    def __init__(self, bits = 10, capacity = 128, overflow = "fifo"):
+        """Initialize LSH table of fixed capacity buckets
+
+        Parameters
+        ----------
+        bits : int, optional
+            Number of lower bits of hash code indexing `2**bits` buckets.
+            The default is `10`.
+        capacity : int, optional
+            Number of neurons in a bucket. The default is `128`.
+        overflow : {"fifo", "reservoir"}, optional
+            Policy for a full bucket. `"fifo"` drops the oldest neuron,
+            `"reservoir"` keeps uniform samples of inserted neurons.
+            The default is `"fifo"`.
+        """
+        pass
+
+
 cdef class Scheduler:
     cdef shared_ptr[slide.Scheduler] sch
 
@@ -323,16 +433,29 @@ cdef class SoftmaxCrossEntropy:
         return y_soft - y_true
 
 
+# What Network._fit runs
+cdef enum Fit:
+    FitLoss            # sampled softmax loss (and its gradient) only
+    FitSampledSoftmax  # train step with sampled softmax
+    FitSoftmax         # train step with dense softmax cross entropy
+
+
 @cython.embedsignature(True)
 cdef class Network:
     cdef slide.Network[float]* net
     cdef slide.BatchData[float] Y
     cdef BatchWrapper y
+    cdef bint sampled
 
     def __cinit__(self, input_size, units=(30, 30, 30), L_tables = 50,
                   hash = None, optimizer = None, scheduler = None,
                   activation = None, initializer = None,
-                  L1 = 0, L2 = 0, sparsity = 0.5, *args, **kwargs):
+                  L1 = 0, L2 = 0, sparsity = 0.5,
+                  sparse_update = False, gradient = "atomic",
+                  incremental_rehash = False, table = None,
+                  retrieval = "union", min_votes = 2, probes = 1,
+                  input_hash = None, execution = "sample",
+                  output = "identity", *args, **kwargs):
 
         if input_size <= 0:
             raise ValueError(f"input_size must be positive: {input_size}")
@@ -346,9 +469,34 @@ cdef class Network:
         if sparsity <= 0:
             raise ValueError(f"sparsity must be positive: {sparsity}")
 
+        if gradient not in ("atomic", "per_thread", "hogwild"):
+            raise ValueError("gradient must be 'atomic', 'per_thread' or 'hogwild': "
+                             f"{gradient}")
+
+        if retrieval not in ("union", "topk", "threshold"):
+            raise ValueError("retrieval must be 'union', 'topk' or 'threshold': "
+                             f"{retrieval}")
+
+        if min_votes <= 0:
+            raise ValueError(f"min_votes must be positive: {min_votes}")
+
+        if probes <= 0:
+            raise ValueError(f"probes must be positive: {probes}")
+
+        if execution not in ("sample", "layer"):
+            raise ValueError(f"execution must be 'sample' or 'layer': {execution}")
+
+        if output not in ("identity", "sampled_softmax"):
+            raise ValueError("output must be 'identity' or 'sampled_softmax': "
+                             f"{output}")
+
+        if output == "sampled_softmax" and len(units) == 0:
+            raise ValueError("output 'sampled_softmax' requires hidden layer")
+
         cdef size_t K_hashes = 8
         cdef size_t sample_size = 8
         cdef Hash h = hash or DWTA(K_hashes, input_size)
+        cdef Hash ih = input_hash or h
 
         cdef float lr = 1e-4
         cdef Optimizer opt = optimizer or Adam(lr)
@@ -368,17 +516,54 @@ cdef class Network:
 
         cdef float sp = sparsity
 
+        cdef slide.NetworkOption option
+        option.sparse_update = sparse_update
+        if gradient == "per_thread":
+            option.gradient = slide.GradientPerThread
+        elif gradient == "hogwild":
+            option.gradient = slide.GradientHogwild
+        else:
+            option.gradient = slide.GradientAtomic
+        option.incremental_rehash = incremental_rehash
+
+        cdef Table tbl = table or MapTable()
+        option.table = tbl.ptr()
+
+        if retrieval == "topk":
+            option.retrieval = slide.RetrievalTopK
+        elif retrieval == "threshold":
+            option.retrieval = slide.RetrievalThreshold
+        else:
+            option.retrieval = slide.RetrievalUnion
+        option.min_votes = min_votes
+        option.probes = probes
+        if execution == "layer":
+            option.execution = slide.ExecutionLayerWise
+        else:
+            option.execution = slide.ExecutionSample
+        self.sampled = (output == "sampled_softmax")
+        if self.sampled:
+            option.output = slide.OutputSampledSoftmax
+        else:
+            option.output = slide.OutputIdentity
+
         cdef vector[size_t] u = units
         self.net = new slide.Network[float](input_size, u, L_tables,
                                             h.ptr(), opt.ptr(), sch.ptr(),
-                                            act.ptr(), init.ptr(), l1, l2, sp)
+                                            act.ptr(), init.ptr(), l1, l2, sp,
+                                            option, ih.ptr())
 
         self.y = BatchWrapper()
 
     def __init__(self, input_size, units=(30, 30, 30), L_tables = 50,
                  hash = None, optimizer = None, scheduler = None,
                  activation = None, initializer = None,
-                 L1=0, L2=0, sparsity = 0.5, *args, **kwargs):
+                 L1=0, L2=0, sparsity = 0.5,
+                 sparse_update = False, gradient = "atomic",
+                 incremental_rehash = False, table = None,
+                 retrieval = "union", min_votes = 2, probes = 1,
+                 input_hash = None, execution = "sample",
+                 output = "identity", *args, **kwargs):
         """
         Initialize SLIDE network
 
@@ -397,8 +582,9 @@ cdef class Network:
         scheduler : HashDL.Scheduler, optional
             Scheduler for re-hash. The default is `HashDL.ExponentialDecay(50, 1e-3)`
         activation : HashDL.Activation, optional
-            Activation function for hidden layer.
-            The default is `HashDL.ReLU()`
+            Activation function for hidden layer. Dense layers are
+            specialized for built-in activations, so that activation is
+            fused into affine calculation. The default is `HashDL.ReLU()`
         initializer : HashDL.initializer, optional
             Weight initializer for hidden layers.
             The default is `HashDL.GaussInitializer(0, 1.0)`
@@ -408,6 +594,62 @@ cdef class Network:
             L2 weight normalization.
         sparsity : float, optional
             Active neuron minimum ratio at dense layer.
+        sparse_update : bool, optional
+            Update only neurons which received gradient in the batch.
+            If `False`, all parameters are updated after every batch.
+            Untouched parameters skip moment decay of `HashDL.Adam`
+            unless it is lazy, so that training differs from dense update.
+            The default is `False`.
+        gradient : {"atomic", "per_thread", "hogwild"}, optional
+            How gradients are accumulated over a batch.
+            `"atomic"` adds into shared gradient atomically.
+            `"per_thread"` accumulates into thread private buffers
+            and sums them up before update.
+            `"hogwild"` applies optimizer at each sample without lock
+            (asynchronous and non-deterministic, but scales with cores).
+            Since every sample takes a full optimizer step, the effective
+            learning rate scales with batch size (divide `lr` by batch size
+            to match the others). Step count for Adam bias correction
+            advances once per batch like the others.
+            The default is `"atomic"`.
+        incremental_rehash : bool, optional
+            If `True`, hash functions are kept at rehash and only neurons
+            whose hash codes changed are moved. The default is `False`.
+        table : HashDL.Table, optional
+            Layout of LSH tables. The default is `HashDL.MapTable()`
+        retrieval : {"union", "topk", "threshold"}, optional
+            How active neurons are selected from colliding neurons.
+            `"union"` collects neurons from randomly ordered tables
+            until `sparsity` is reached.
+            `"topk"` counts colliding tables over all tables and
+            selects the most voted neurons up to `sparsity`.
+            `"threshold"` selects neurons colliding at `min_votes`
+            tables or more. The default is `"union"`.
+        min_votes : int, optional
+            Minimum number of colliding tables for `"threshold"`.
+            The default is `2`.
+        probes : int, optional
+            Number of probed buckets per table (multi-probe LSH).
+            Neighbouring buckets are made by replacing the max of
+            a WTA/DWTA bin with its runner-up, or by flipping the SRP bit
+            of the smallest projection. `HashDL.DOPH` has no neighbouring
+            bucket, so that it probes only one. The default is `1`.
+        input_hash : HashDL.Hash, optional
+            Locality sensitive hash function for the first hidden layer,
+            e.g. `HashDL.DOPH` for sparse input. The default is `hash`.
+        execution : {"sample", "layer"}, optional
+            How a batch runs through layers.
+            `"sample"` runs each sample through the whole layer chain.
+            `"layer"` runs each layer over the whole batch before the next
+            layer, with persistent per-layer buffers. The default is `"sample"`.
+        output : {"identity", "sampled_softmax"}, optional
+            Output layer. `"identity"` outputs the last hidden layer.
+            `"sampled_softmax"` makes the last hidden layer linear logits over
+            classes (`units[-1]`), and `loss` computes softmax cross entropy
+            only over LSH retrieved classes and true labels, so that its cost
+            doesn't depend on the number of classes. `__call__` and `predict`
+            give `-inf` logits to classes which are not retrieved.
+            The default is `"identity"`.
         """
         pass
 
@@ -420,15 +662,20 @@ cdef class Network:
 
         Parameters
         ----------
-        X : array-like of float
-            Input batch data. The shape must be [batch_size, input_size]
+        X : array-like of float or scipy.sparse matrix
+            Input batch data. The shape must be [batch_size, input_size].
+            Sparse matrix is passed as CSR without densifying.
 
         Returns
         -------
         Y : np.ndarray
             Output layer's value (aka. activated last hidden layer's value)
         """
+        if hasattr(X, "tocsr"):
+            return self._call_csr(self._tocsr(X))
+
         X = np.array(X, ndmin=2, copy=False, dtype=np.single, order="C")
+        self._check_input(X)
 
         cdef float[:,:] x = X
         cdef slide.BatchView[float] *view = new slide.BatchView[float](x.shape[1],
@@ -441,7 +688,247 @@ cdef class Network:
         del view
         return np.asarray(self.y)
 
-    def backward(self, dL_dY):
+    def _check_input(self, X):
+        if X.shape[1] != self.net.input_size():
+            raise ValueError(f"X must have {self.net.input_size()} columns: {X.shape}")
+
+    def _tocsr(self, X):
+        # Network requires unique indices in a row, so that duplicates are summed
+        # (on a copy, not to modify the caller's matrix).
+        X = X.tocsr()
+        if not X.has_canonical_format:
+            X = X.copy()
+            X.sum_duplicates()
+        return X
+
+    def _call_csr(self, X):
+        self._check_input(X)
+        indptr = np.array(X.indptr, copy=False, dtype=np.uintp, order="C")
+        indices = np.array(X.indices, copy=False, dtype=np.uintp, order="C")
+        values = np.array(X.data, copy=False, dtype=np.single, order="C")
+
+        cdef size_t[:] ip = indptr
+        cdef size_t[:] ix = indices
+        cdef float[:] v = values
+        cdef size_t* ix_ptr = &ix[0] if ix.shape[0] > 0 else NULL
+        cdef float* v_ptr = &v[0] if v.shape[0] > 0 else NULL
+        cdef slide.CSRView[float] *view = new slide.CSRView[float](X.shape[1],
+                                                                   X.shape[0],
+                                                                   &ip[0],
+                                                                   ix_ptr,
+                                                                   v_ptr)
+
+        self.Y = dereference(self.net)(dereference(view))
+        self.y.set(&self.Y)
+
+        del view
+        return np.asarray(self.y)
+
+    def predict(self, X):
+        """
+        Inference over batch input without training state
+
+        Unlike `__call__`, this doesn't store values for `backward`,
+        and releases GIL during calculation. Multiple threads can call
+        this on the same network at the same time, as long as
+        the network is not trained at the same time.
+
+        Parameters
+        ----------
+        X : array-like of float or scipy.sparse matrix
+            Input batch data. The shape must be [batch_size, input_size].
+            Sparse matrix is passed as CSR without densifying.
+
+        Returns
+        -------
+        Y : np.ndarray
+            Output layer's value (aka. activated last hidden layer's value)
+        """
+        if hasattr(X, "tocsr"):
+            return self._predict_csr(self._tocsr(X))
+
+        X = np.array(X, ndmin=2, copy=False, dtype=np.single, order="C")
+        self._check_input(X)
+        Y = np.empty((X.shape[0], self.net.output_size()), dtype=np.single)
+        if X.shape[0] == 0:
+            return Y
+
+        cdef float[:,:] x = X
+        cdef float[:,:] y = Y
+        cdef slide.BatchView[float] *view = new slide.BatchView[float](x.shape[1],
+                                                                       x.shape[0],
+                                                                       &x[0,0])
+        try:
+            with nogil:
+                self.net.predict(dereference(view), &y[0,0])
+        finally:
+            del view
+        return Y
+
+    def _predict_csr(self, X):
+        self._check_input(X)
+        indptr = np.array(X.indptr, copy=False, dtype=np.uintp, order="C")
+        indices = np.array(X.indices, copy=False, dtype=np.uintp, order="C")
+        values = np.array(X.data, copy=False, dtype=np.single, order="C")
+        Y = np.empty((X.shape[0], self.net.output_size()), dtype=np.single)
+        if X.shape[0] == 0:
+            return Y
+
+        cdef size_t[:] ip = indptr
+        cdef size_t[:] ix = indices
+        cdef float[:] v = values
+        cdef float[:,:] y = Y
+        cdef size_t* ix_ptr = &ix[0] if ix.shape[0] > 0 else NULL
+        cdef float* v_ptr = &v[0] if v.shape[0] > 0 else NULL
+        cdef slide.CSRView[float] *view = new slide.CSRView[float](X.shape[1],
+                                                                   X.shape[0],
+                                                                   &ip[0],
+                                                                   ix_ptr,
+                                                                   v_ptr)
+        try:
+            with nogil:
+                self.net.predict(dereference(view), &y[0,0])
+        finally:
+            del view
+        return Y
+
+    def loss(self, X, y):
+        """
+        Forward calculation and sampled softmax cross entropy
+
+        Logits are calculated only for LSH retrieved classes and true labels.
+        The gradient is kept for `backward()`. Only for
+        `output="sampled_softmax"`. GIL is released during calculation.
+
+        Parameters
+        ----------
+        X : array-like of float or scipy.sparse matrix
+            Input batch data. The shape must be [batch_size, input_size].
+        y : array-like of int or scipy.sparse matrix
+            True class label of each sample, or multi-hot labels
+            of [batch_size, units[-1]] as sparse matrix.
+            Target probability is uniform over labels of each sample.
+
+        Returns
+        -------
+        loss : float
+            Mean of softmax cross entropy over batch
+        """
+        return self._fit(X, y, FitLoss)
+
+    def train_step(self, X, y, loss = None):
+        """
+        Train a single step over batch
+
+        Forward calculation, loss and its gradient, backward propagation
+        and parameter update run in C++ with GIL released, so that no
+        intermediate array is passed through Python.
+
+        Parameters
+        ----------
+        X : array-like of float or scipy.sparse matrix
+            Input batch data. The shape must be [batch_size, input_size].
+        y : array-like or scipy.sparse matrix
+            For `"sampled_softmax"`, true class labels as `loss`.
+            For `"softmax_cross_entropy"`, one hot encoded true class label
+            (or target probability) of [batch_size, output size].
+        loss : {"softmax_cross_entropy", "sampled_softmax"} or HashDL.SoftmaxCrossEntropy, optional
+            Loss function. The default is `"sampled_softmax"` for
+            `output="sampled_softmax"`, otherwise `"softmax_cross_entropy"`.
+
+        Returns
+        -------
+        loss : float
+            Mean loss over batch before update
+        """
+        if loss is None:
+            loss = "sampled_softmax" if self.sampled else "softmax_cross_entropy"
+        elif isinstance(loss, SoftmaxCrossEntropy):
+            loss = "softmax_cross_entropy"
+
+        if loss == "sampled_softmax":
+            return self._fit(X, y, FitSampledSoftmax)
+        if loss == "softmax_cross_entropy":
+            return self._fit(X, y, FitSoftmax)
+        raise ValueError("loss must be 'softmax_cross_entropy' or 'sampled_softmax': "
+                         f"{loss}")
+
+    cdef float _fit(self, X, y, Fit fit) except *:
+        cdef size_t[:] lp
+        cdef size_t[:] li
+        cdef size_t* li_ptr
+        cdef float[:,:] t
+        cdef float[:,:] x
+        cdef size_t[:] ip
+        cdef size_t[:] ix
+        cdef float[:] v
+        cdef size_t* ix_ptr
+        cdef float* v_ptr
+        cdef slide.LabelView* label = NULL
+        cdef slide.BatchView[float]* target = NULL
+        cdef slide.BatchView[float]* dense = NULL
+        cdef slide.CSRView[float]* csr = NULL
+        cdef float L
+
+        try:
+            if fit == FitSoftmax:
+                t = np.array(y, ndmin=2, copy=False, dtype=np.single, order="C")
+                target = new slide.BatchView[float](t.shape[1], t.shape[0], &t[0,0])
+            elif hasattr(y, "tocsr"):
+                y = y.tocsr()
+                lp = np.array(y.indptr, copy=False, dtype=np.uintp, order="C")
+                li = np.array(y.indices, copy=False, dtype=np.uintp, order="C")
+            else:
+                y = np.array(y, ndmin=1, copy=False)
+                if y.ndim != 1:
+                    raise ValueError(f"y must be 1d labels or sparse matrix: {y.shape}")
+                if (y < 0).any():
+                    raise ValueError("y must be non-negative")
+                li = np.array(y, copy=False, dtype=np.uintp, order="C")
+                lp = np.arange(y.shape[0] + 1, dtype=np.uintp)
+
+            if fit != FitSoftmax:
+                li_ptr = &li[0] if li.shape[0] > 0 else NULL
+                label = new slide.LabelView(lp.shape[0] - 1, &lp[0], li_ptr)
+
+            if hasattr(X, "tocsr"):
+                X = self._tocsr(X)
+                self._check_input(X)
+                ip = np.array(X.indptr, copy=False, dtype=np.uintp, order="C")
+                ix = np.array(X.indices, copy=False, dtype=np.uintp, order="C")
+                v = np.array(X.data, copy=False, dtype=np.single, order="C")
+                ix_ptr = &ix[0] if ix.shape[0] > 0 else NULL
+                v_ptr = &v[0] if v.shape[0] > 0 else NULL
+                csr = new slide.CSRView[float](X.shape[1], X.shape[0],
+                                               &ip[0], ix_ptr, v_ptr)
+            else:
+                x = np.array(X, ndmin=2, copy=False, dtype=np.single, order="C")
+                self._check_input(x)
+                dense = new slide.BatchView[float](x.shape[1], x.shape[0], &x[0,0])
+
+            with nogil:
+                if csr != NULL:
+                    if fit == FitLoss:
+                        L = self.net.loss(dereference(csr), dereference(label))
+                    elif fit == FitSampledSoftmax:
+                        L = self.net.train_step(dereference(csr), dereference(label))
+                    else:
+                        L = self.net.train_step(dereference(csr), dereference(target))
+                else:
+                    if fit == FitLoss:
+                        L = self.net.loss(dereference(dense), dereference(label))
+                    elif fit == FitSampledSoftmax:
+                        L = self.net.train_step(dereference(dense), dereference(label))
+                    else:
+                        L = self.net.train_step(dereference(dense), dereference(target))
+        finally:
+            del label
+            del target
+            del dense
+            del csr
+        return L
+
+    def backward(self, dL_dY = None):
         """
         Backward propagation of gradient.
 
@@ -449,7 +936,13 @@ cdef class Network:
         ----------
         dL_dY : array-like
             Gradient of Loss against network output.
+            If `None`, the gradient kept by the last `loss` is used.
         """
+        if dL_dY is None:
+            with nogil:
+                self.net.backward()
+            return
+
         dL_dY = np.array(dL_dY, ndmin=2, copy=False, dtype=np.single, order="C")
 
         cdef float[:,:] dl_dy = dL_dY
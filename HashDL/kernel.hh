@@ -0,0 +1,243 @@
+#ifndef KERNEL_HH
+#define KERNEL_HH
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace HashDL {
+  // Dot product of a weight row w and (active part of) input.
+  //   dot       : sum_i w[i] * x[i]         for i in [0, n)
+  //   gather_dot: sum_j w[i] * x[i]         for i = idx[j]
+  //   sparse_dot: sum_j w[idx[j]] * v[j]    (v is aligned with idx)
+  //   gather_axpy: y[j] += a * w[idx[j]]    (y is aligned with idx)
+  // float uses AVX-512 / AVX2 when available. Indices must be less than 2^31.
+  namespace kernel {
+    // Portable implementation
+    template<typename T> inline T dot_scalar(const T* w, const T* x, std::size_t n){
+      T result = 0;
+      for(std::size_t i=0; i<n; ++i){ result += w[i]*x[i]; }
+      return result;
+    }
+
+    template<typename T>
+    inline T gather_dot_scalar(const T* w, const std::size_t* idx, const T* x,
+			       std::size_t n){
+      T result = 0;
+      for(std::size_t j=0; j<n; ++j){ result += w[idx[j]]*x[idx[j]]; }
+      return result;
+    }
+
+    template<typename T>
+    inline T sparse_dot_scalar(const T* w, const std::size_t* idx, const T* v,
+			       std::size_t n){
+      T result = 0;
+      for(std::size_t j=0; j<n; ++j){ result += w[idx[j]]*v[j]; }
+      return result;
+    }
+
+    template<typename T>
+    inline void gather_axpy_scalar(T a, const T* w, const std::size_t* idx, T* y,
+				   std::size_t n){
+      for(std::size_t j=0; j<n; ++j){ y[j] += a * w[idx[j]]; }
+    }
+
+#if defined(__AVX512F__)
+    // 16 indices of size_t into 32bit
+    inline __m512i load_index16(const std::size_t* idx){
+#ifndef NDEBUG
+      for(std::size_t j=0; j<16; ++j){
+	assert(idx[j] <= std::size_t(std::numeric_limits<std::int32_t>::max()));
+      }
+#endif
+      const auto lo = _mm512_maskz_cvtepi64_epi32(0xFF, _mm512_loadu_si512(idx));
+      const auto hi = _mm512_maskz_cvtepi64_epi32(0xFF, _mm512_loadu_si512(idx + 8));
+      const auto l = _mm512_maskz_inserti64x4(0xFF, _mm512_setzero_si512(), lo, 0);
+      return _mm512_maskz_inserti64x4(0xFF, l, hi, 1);
+    }
+
+    // Horizontal sum. _mm512_reduce_add_ps (and 512->256 cast) extracts
+    // from undefined source, which warns with -Wmaybe-uninitialized.
+    inline float reduce_add512(__m512 v){
+      const auto d = _mm512_castps_pd(v);
+      const auto lo = _mm512_maskz_extractf64x4_pd(0xF, d, 0);
+      const auto hi = _mm512_maskz_extractf64x4_pd(0xF, d, 1);
+      const auto s8 = _mm256_add_ps(_mm256_castpd_ps(lo), _mm256_castpd_ps(hi));
+      const auto s4 = _mm_add_ps(_mm256_castps256_ps128(s8), _mm256_extractf128_ps(s8, 1));
+      const auto s2 = _mm_add_ps(s4, _mm_movehl_ps(s4, s4));
+      return _mm_cvtss_f32(_mm_add_ss(s2, _mm_shuffle_ps(s2, s2, 1)));
+    }
+
+    // Masked gather with zero source, since unmasked one reads uninitialized source.
+    inline __m512 gather16(const float* base, __m512i i){
+      return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, i, base, sizeof(float));
+    }
+
+    inline float dot_avx512(const float* w, const float* x, std::size_t n){
+      auto acc = _mm512_setzero_ps();
+      std::size_t i = 0;
+      for(; i+16<=n; i+=16){
+	acc = _mm512_fmadd_ps(_mm512_loadu_ps(w + i), _mm512_loadu_ps(x + i), acc);
+      }
+      if(i < n){
+	const __mmask16 m = (1u << (n - i)) - 1;
+	acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, w + i),
+			      _mm512_maskz_loadu_ps(m, x + i), acc);
+      }
+      return reduce_add512(acc);
+    }
+
+    inline float gather_dot_avx512(const float* w, const std::size_t* idx, const float* x,
+				   std::size_t n){
+      auto acc = _mm512_setzero_ps();
+      std::size_t j = 0;
+      for(; j+16<=n; j+=16){
+	const auto i = load_index16(idx + j);
+	acc = _mm512_fmadd_ps(gather16(w, i), gather16(x, i), acc);
+      }
+      return reduce_add512(acc) + gather_dot_scalar(w, idx + j, x, n - j);
+    }
+
+    inline float sparse_dot_avx512(const float* w, const std::size_t* idx, const float* v,
+				   std::size_t n){
+      auto acc = _mm512_setzero_ps();
+      std::size_t j = 0;
+      for(; j+16<=n; j+=16){
+	const auto i = load_index16(idx + j);
+	acc = _mm512_fmadd_ps(gather16(w, i), _mm512_loadu_ps(v + j), acc);
+      }
+      return reduce_add512(acc) + sparse_dot_scalar(w, idx + j, v + j, n - j);
+    }
+
+    inline void gather_axpy_avx512(float a, const float* w, const std::size_t* idx, float* y,
+				   std::size_t n){
+      const auto av = _mm512_set1_ps(a);
+      std::size_t j = 0;
+      for(; j+16<=n; j+=16){
+	const auto wv = gather16(w, load_index16(idx + j));
+	_mm512_storeu_ps(y + j, _mm512_fmadd_ps(av, wv, _mm512_loadu_ps(y + j)));
+      }
+      gather_axpy_scalar(a, w, idx + j, y + j, n - j);
+    }
+#endif
+
+#if defined(__AVX2__)
+    inline __m256 fmadd256(__m256 a, __m256 b, __m256 c){
+#if defined(__FMA__)
+      return _mm256_fmadd_ps(a, b, c);
+#else
+      return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+    }
+
+    inline float reduce_add256(__m256 v){
+      const auto s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+      const auto h = _mm_add_ps(s, _mm_movehl_ps(s, s));
+      return _mm_cvtss_f32(_mm_add_ss(h, _mm_shuffle_ps(h, h, 1)));
+    }
+
+    // 8 gathered floats by size_t indices
+    inline __m256 gather8(const float* base, const std::size_t* idx){
+      const auto lo = _mm256_i64gather_ps(base, _mm256_loadu_si256((const __m256i*)idx),
+					  sizeof(float));
+      const auto hi = _mm256_i64gather_ps(base, _mm256_loadu_si256((const __m256i*)(idx + 4)),
+					  sizeof(float));
+      return _mm256_set_m128(hi, lo);
+    }
+
+    inline float dot_avx2(const float* w, const float* x, std::size_t n){
+      auto acc = _mm256_setzero_ps();
+      std::size_t i = 0;
+      for(; i+8<=n; i+=8){
+	acc = fmadd256(_mm256_loadu_ps(w + i), _mm256_loadu_ps(x + i), acc);
+      }
+      return reduce_add256(acc) + dot_scalar(w + i, x + i, n - i);
+    }
+
+    inline float gather_dot_avx2(const float* w, const std::size_t* idx, const float* x,
+				 std::size_t n){
+      auto acc = _mm256_setzero_ps();
+      std::size_t j = 0;
+      for(; j+8<=n; j+=8){
+	acc = fmadd256(gather8(w, idx + j), gather8(x, idx + j), acc);
+      }
+      return reduce_add256(acc) + gather_dot_scalar(w, idx + j, x, n - j);
+    }
+
+    inline float sparse_dot_avx2(const float* w, const std::size_t* idx, const float* v,
+				 std::size_t n){
+      auto acc = _mm256_setzero_ps();
+      std::size_t j = 0;
+      for(; j+8<=n; j+=8){
+	acc = fmadd256(gather8(w, idx + j), _mm256_loadu_ps(v + j), acc);
+      }
+      return reduce_add256(acc) + sparse_dot_scalar(w, idx + j, v + j, n - j);
+    }
+
+    inline void gather_axpy_avx2(float a, const float* w, const std::size_t* idx, float* y,
+				 std::size_t n){
+      const auto av = _mm256_set1_ps(a);
+      std::size_t j = 0;
+      for(; j+8<=n; j+=8){
+	_mm256_storeu_ps(y + j, fmadd256(av, gather8(w, idx + j), _mm256_loadu_ps(y + j)));
+      }
+      gather_axpy_scalar(a, w, idx + j, y + j, n - j);
+    }
+#endif
+
+    template<typename T> inline T dot(const T* w, const T* x, std::size_t n){
+      if constexpr (std::is_same_v<T, float>){
+#if defined(__AVX512F__)
+	return dot_avx512(w, x, n);
+#elif defined(__AVX2__)
+	return dot_avx2(w, x, n);
+#endif
+      }
+      return dot_scalar(w, x, n);
+    }
+
+    template<typename T>
+    inline T gather_dot(const T* w, const std::size_t* idx, const T* x, std::size_t n){
+      if constexpr (std::is_same_v<T, float>){
+#if defined(__AVX512F__)
+	return gather_dot_avx512(w, idx, x, n);
+#elif defined(__AVX2__)
+	return gather_dot_avx2(w, idx, x, n);
+#endif
+      }
+      return gather_dot_scalar(w, idx, x, n);
+    }
+
+    template<typename T>
+    inline T sparse_dot(const T* w, const std::size_t* idx, const T* v, std::size_t n){
+      if constexpr (std::is_same_v<T, float>){
+#if defined(__AVX512F__)
+	return sparse_dot_avx512(w, idx, v, n);
+#elif defined(__AVX2__)
+	return sparse_dot_avx2(w, idx, v, n);
+#endif
+      }
+      return sparse_dot_scalar(w, idx, v, n);
+    }
+
+    template<typename T>
+    inline void gather_axpy(T a, const T* w, const std::size_t* idx, T* y, std::size_t n){
+      if constexpr (std::is_same_v<T, float>){
+#if defined(__AVX512F__)
+	return gather_axpy_avx512(a, w, idx, y, n);
+#elif defined(__AVX2__)
+	return gather_axpy_avx2(a, w, idx, y, n);
+#endif
+      }
+      gather_axpy_scalar(a, w, idx, y, n);
+    }
+  }
+}
+
+#endif
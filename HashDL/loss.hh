@@ -0,0 +1,104 @@
+#ifndef LOSS_HH
+#define LOSS_HH
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <span>
+#include <stdexcept>
+
+namespace HashDL {
+  template<typename T> inline T log_sum_exp(std::span<const T> z){
+    if(z.empty()){ return T{0}; }
+    const auto m = *std::max_element(z.begin(), z.end());
+    T s = 0;
+    for(auto v : z){ s += std::exp(v - m); }
+    return m + std::log(s);
+  }
+
+
+  // Softmax cross entropy over all classes against target probability t,
+  // whose sum is 1 (e.g. one hot label).
+  template<typename T> class SoftmaxCrossEntropy {
+  public:
+    SoftmaxCrossEntropy() = default;
+    SoftmaxCrossEntropy(const SoftmaxCrossEntropy&) = default;
+    SoftmaxCrossEntropy(SoftmaxCrossEntropy&&) = default;
+    SoftmaxCrossEntropy& operator=(const SoftmaxCrossEntropy&) = default;
+    SoftmaxCrossEntropy& operator=(SoftmaxCrossEntropy&&) = default;
+    ~SoftmaxCrossEntropy() = default;
+
+    T forward(std::span<const T> z, std::span<const T> t) const {
+      const auto lse = log_sum_exp(z);
+      T L = 0;
+      for(std::size_t j=0; j<z.size(); ++j){ L += t[j] * (lse - z[j]); }
+      return L;
+    }
+
+    // Write dL/dz into dL_dz, and return loss. dL_dz can overwrite z.
+    T backward(std::span<const T> z, std::span<const T> t, T* dL_dz) const {
+      const auto lse = log_sum_exp(z);
+      T L = 0;
+      for(std::size_t j=0; j<z.size(); ++j){
+	L += t[j] * (lse - z[j]);
+	dL_dz[j] = std::exp(z[j] - lse) - t[j];
+      }
+      return L;
+    }
+  };
+
+
+  // Softmax cross entropy over a sparse class set.
+  // Logits z are aligned with class id (e.g. LSH retrieved classes and true labels),
+  // and classes outside of id are ignored, so that cost is independent of
+  // the number of all classes. Target probability is uniform over label,
+  // which must be included in id.
+  template<typename T> class SparseSoftmaxCrossEntropy {
+  private:
+    static std::size_t position(std::span<const std::size_t> id, std::size_t l){
+      const auto it = std::find(id.begin(), id.end(), l);
+      if(it == id.end()){ throw std::runtime_error("Label is not in class set"); }
+      return it - id.begin();
+    }
+  public:
+    SparseSoftmaxCrossEntropy() = default;
+    SparseSoftmaxCrossEntropy(const SparseSoftmaxCrossEntropy&) = default;
+    SparseSoftmaxCrossEntropy(SparseSoftmaxCrossEntropy&&) = default;
+    SparseSoftmaxCrossEntropy& operator=(const SparseSoftmaxCrossEntropy&) = default;
+    SparseSoftmaxCrossEntropy& operator=(SparseSoftmaxCrossEntropy&&) = default;
+    ~SparseSoftmaxCrossEntropy() = default;
+
+    // Loss of a single sample. 0 without label.
+    T forward(std::span<const std::size_t> id, std::span<const T> z,
+	      std::span<const std::size_t> label) const {
+      if(label.empty()){ return T{0}; }
+
+      T zt = 0;
+      for(auto l : label){ zt += z[position(id, l)]; }
+      return log_sum_exp(z) - zt / label.size();
+    }
+
+    // Write dL/dz (aligned with id) into dL_dz, and return loss.
+    T backward(std::span<const std::size_t> id, std::span<const T> z,
+	       std::span<const std::size_t> label, T* dL_dz) const {
+      if(label.empty()){
+	std::fill_n(dL_dz, z.size(), T{0});
+	return T{0};
+      }
+
+      const auto lse = log_sum_exp(z);
+      for(std::size_t j=0; j<z.size(); ++j){ dL_dz[j] = std::exp(z[j] - lse); }
+
+      const T t = T{1} / label.size();
+      T zt = 0;
+      for(auto l : label){
+	const auto j = position(id, l);
+	dL_dz[j] -= t;
+	zt += z[j];
+      }
+      return lse - zt * t;
+    }
+  };
+}
+
+#endif
@@ -1,8 +1,13 @@
 #ifndef OPTIMIZER_HH
 #define OPTIMIZER_HH
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <execution>
+#include <span>
 #include <string>
+#include <vector>
 
 namespace HashDL {
   template<typename T> class OptimizerClient {
@@ -18,6 +23,26 @@ namespace HashDL {
     virtual std::string to_string() const = 0;
   };
 
+  // Apply element-wise kernel f(i) over [0, N).
+  // Large spans are split into chunks and processed in parallel,
+  // each chunk is a plain loop so that compiler can vectorize it.
+  template<typename F> inline void for_each_chunk(std::size_t N, F&& f){
+    constexpr const std::size_t chunk = 4096;
+    auto loop = [&f](std::size_t begin, std::size_t end){
+      for(std::size_t i=begin; i<end; ++i){ f(i); }
+    };
+
+    if(N <= chunk){
+      loop(0, N);
+      return;
+    }
+
+    std::vector<std::size_t> c((N + chunk - 1) / chunk);
+    std::generate(c.begin(), c.end(), [i=std::size_t{0}]() mutable { return chunk * i++; });
+    std::for_each(std::execution::par, c.begin(), c.end(),
+		  [&](auto begin){ loop(begin, std::min(begin + chunk, N)); });
+  }
+
   template<typename T> class Optimizer {
   public:
     Optimizer() = default;
@@ -30,6 +55,27 @@ namespace HashDL {
     virtual OptimizerClient<T>* client() const = 0;
     virtual void step(){}
     virtual std::string to_string() const = 0;
+
+    // Number of per parameter state blocks (e.g. m and v for Adam)
+    virtual std::size_t state_size() const noexcept { return 0; }
+
+    // Update parameters w with gradients g and reset g to 0.
+    // m and v are state blocks, which are empty when state_size() is smaller.
+    virtual void update(std::span<T> w, std::span<T> g,
+			std::span<T> m, std::span<T> v) const = 0;
+
+    // Same as above, but only for elements at idx
+    virtual void update(std::span<T> w, std::span<T> g,
+			std::span<T> m, std::span<T> v,
+			std::span<const std::size_t> idx) const = 0;
+
+    // Lazy optimizer doesn't touch states of parameters without gradient.
+    // Instead, the skipped steps are applied by catch_up() before
+    // the next update of the parameters.
+    virtual bool lazy() const noexcept { return false; }
+    virtual std::uintmax_t steps() const noexcept { return 0; }
+    virtual void catch_up(std::span<T> /* m */, std::span<T> /* v */,
+			  std::uintmax_t /* skipped */) const {}
   };
 
   template<typename T> class SGD;
@@ -46,7 +92,7 @@ namespace HashDL {
     ~SGDClient() = default;
 
     virtual T diff(T grad){
-      return - sgd->eta() * grad;
+      return sgd->diff(grad);
     }
 
     std::string to_string() const override {
@@ -73,6 +119,25 @@ namespace HashDL {
     }
     void step() override { _eta *= decay; }
     const auto eta() const { return _eta; }
+    T diff(T grad) const noexcept { return - _eta * grad; }
+
+    auto kernel(std::span<T> w, std::span<T> g) const noexcept {
+      return [eta=_eta, pw=w.data(), pg=g.data()](std::size_t i){
+	pw[i] += - eta * pg[i];
+	pg[i] = 0;
+      };
+    }
+
+    void update(std::span<T> w, std::span<T> g,
+		std::span<T> /* m */, std::span<T> /* v */) const override {
+      for_each_chunk(w.size(), kernel(w, g));
+    }
+
+    void update(std::span<T> w, std::span<T> g,
+		std::span<T> /* m */, std::span<T> /* v */,
+		std::span<const std::size_t> idx) const override {
+      for_each_chunk(idx.size(), [k=kernel(w, g), idx](auto j){ k(idx[j]); });
+    }
 
     std::string to_string() const override {
       std::string msg = "SGD<T>(eta=" + std::to_string(_eta) +
@@ -97,16 +162,7 @@ namespace HashDL {
     ~AdamClient() = default;
 
     T diff(T grad) override {
-      const auto beta1 = adam->beta1();
-      const auto beta2 = adam->beta2();
-
-      m = beta1 * m + (1 - beta1) * grad;
-      v = beta2 * v + (1 - beta2) * grad * grad;
-
-      const auto m_hat = m / (1 - adam->beta1t());
-      const auto v_hat = v / (1 - adam->beta2t());
-
-      return - adam->eta() * m_hat / (std::sqrt(v_hat) + adam->eps());
+      return adam->kernel()(m, v, grad);
     }
 
     std::string to_string() const override {
@@ -115,6 +171,27 @@ namespace HashDL {
     }
   };
 
+  // Single Adam step with hyperparameters copied by value,
+  // so that loops over spans don't reload them through pointers.
+  template<typename T> struct AdamKernel {
+    T beta1;
+    T beta2;
+    T beta1t;
+    T beta2t;
+    T eta;
+    T eps;
+
+    T operator()(T& m, T& v, T grad) const noexcept {
+      m = beta1 * m + (1 - beta1) * grad;
+      v = beta2 * v + (1 - beta2) * grad * grad;
+
+      const auto m_hat = m / (1 - beta1t);
+      const auto v_hat = v / (1 - beta2t);
+
+      return - eta * m_hat / (std::sqrt(v_hat) + eps);
+    }
+  };
+
   template<typename T> class Adam : public Optimizer<T> {
   private:
     T _eps;
@@ -123,11 +200,14 @@ namespace HashDL {
     T _beta1t;
     T _beta2;
     T _beta2t;
+    std::uintmax_t _t;
+    bool _lazy;
   public:
     Adam(): Adam{1e-3} {}
     Adam(T lr): Adam{lr, 0.9, 0.999} {}
-    Adam(T lr, T b1, T b2, T e=1e-8)
-      : _eps{e}, _eta{lr}, _beta1{b1}, _beta1t{b1}, _beta2{b2}, _beta2t{b2} {}
+    Adam(T lr, T b1, T b2, T e=1e-8, bool lazy=false)
+      : _eps{e}, _eta{lr}, _beta1{b1}, _beta1t{b1}, _beta2{b2}, _beta2t{b2},
+	_t{0}, _lazy{lazy} {}
     Adam(const Adam&) = default;
     Adam(Adam&&) = default;
     Adam& operator=(const Adam&) = default;
@@ -139,6 +219,7 @@ namespace HashDL {
     void step() override {
       _beta1t *= _beta1;
       _beta2t *= _beta2;
+      ++_t;
     }
     const auto eps() const noexcept { return _eps; }
     const auto eta() const noexcept { return _eta; }
@@ -146,12 +227,52 @@ namespace HashDL {
     const auto beta1t() const noexcept { return _beta1t; }
     const auto beta2() const noexcept { return _beta2; }
     const auto beta2t() const noexcept { return _beta2t; }
+    auto kernel() const noexcept {
+      return AdamKernel<T>{_beta1, _beta2, _beta1t, _beta2t, _eta, _eps};
+    }
+
+    std::size_t state_size() const noexcept override { return 2; }
+    bool lazy() const noexcept override { return _lazy; }
+    std::uintmax_t steps() const noexcept override { return _t; }
+
+    // Skipped steps have 0 gradient: m <- beta1^k m, v <- beta2^k v
+    void catch_up(std::span<T> m, std::span<T> v,
+		  std::uintmax_t skipped) const override {
+      if(!skipped){ return; }
+
+      const T d1 = std::pow(_beta1, skipped);
+      const T d2 = std::pow(_beta2, skipped);
+      for_each_chunk(m.size(), [d1, d2, pm=m.data(), pv=v.data()](auto i){
+	pm[i] *= d1;
+	pv[i] *= d2;
+      });
+    }
+
+    auto kernel(std::span<T> w, std::span<T> g,
+		std::span<T> m, std::span<T> v) const noexcept {
+      return [k=kernel(), pw=w.data(), pg=g.data(), pm=m.data(), pv=v.data()](std::size_t i){
+	pw[i] += k(pm[i], pv[i], pg[i]);
+	pg[i] = 0;
+      };
+    }
+
+    void update(std::span<T> w, std::span<T> g,
+		std::span<T> m, std::span<T> v) const override {
+      for_each_chunk(w.size(), kernel(w, g, m, v));
+    }
+
+    void update(std::span<T> w, std::span<T> g,
+		std::span<T> m, std::span<T> v,
+		std::span<const std::size_t> idx) const override {
+      for_each_chunk(idx.size(), [k=kernel(w, g, m, v), idx](auto j){ k(idx[j]); });
+    }
 
     std::string to_string() const override {
       std::string msg = "Adam<T>(eps=" + std::to_string(_eps)
 	+ " ,eta=" + std::to_string(_eta)
 	+ " ,beta1=" + std::to_string(_beta1)
-	+ " ,beta2=" + std::to_string(_beta2) + ")";
+	+ " ,beta2=" + std::to_string(_beta2)
+	+ (_lazy ? " ,lazy=true)" : ")");
       return msg;
     }
   };
@@ -2,65 +2,418 @@
 #define SLIDE_HH
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <execution>
+#include <limits>
+#include <numeric>
 #include <random>
-#include <unordered_set>
+#include <span>
 #include <unordered_map>
+#include <utility>
 
 #include "data.hh"
 #include "activation.hh"
 #include "optimizer.hh"
 #include "hash.hh"
+#include "table.hh"
 #include "scheduler.hh"
 #include "initializer.hh"
+#include "kernel.hh"
+#include "loss.hh"
 
 namespace HashDL {
-  template<typename T> class Param {
+  enum class GradientMode {
+    Atomic,    // atomic add into shared gradient
+    PerThread, // thread private buffer and reduction before update
+    Hogwild,   // apply optimizer immediately at each sample (lock free, racy).
+               // Every sample takes a full optimizer step, so that effective
+               // learning rate scales with batch size compared to the others.
+               // Step count (e.g. Adam bias correction) advances once per batch.
+  };
+
+  // How LSH selects active neurons from colliding ones
+  enum class Retrieval {
+    Union,    // Union of randomly ordered tables until sparsity is reached
+    TopK,     // Most voted neurons over all tables up to sparsity
+    Threshold // Neurons voted by min_votes tables or more
+  };
+
+  // How Network runs forward and backward over a batch
+  enum class Execution {
+    Sample,   // each sample runs through the whole layer chain
+    LayerWise // each layer runs over the whole batch before the next layer
+  };
+
+  // Output layer of Network
+  enum class Output {
+    Identity,      // value of the last hidden layer
+    SampledSoftmax // the last hidden layer is linear logits over classes,
+                   // which are computed only for LSH retrieved classes and true labels
+  };
+
+  // Training options shared by all layers of Network
+  struct NetworkOption {
+    // Update only neurons (and input columns) which received gradient
+    // instead of sweeping whole layers after every batch.
+    // Untouched parameters skip moment decay of stateful optimizer (e.g. Adam)
+    // unless the optimizer is lazy, so that this is opt-in.
+    bool sparse_update = false;
+
+    // How concurrent backward accumulates gradients.
+    GradientMode gradient = GradientMode::Atomic;
+
+    // Layout of LSH tables. (Default: MapTableFunc)
+    std::shared_ptr<TableFunc> table = std::shared_ptr<TableFunc>{};
+
+    Retrieval retrieval = Retrieval::Union;
+    std::size_t min_votes = 2; // Only for Retrieval::Threshold
+
+    // Number of probed buckets per table (multi-probe LSH)
+    std::size_t probes = 1;
+
+    // Keep hash functions at rehash and move only neurons whose codes
+    // changed since the last rehash.
+    bool incremental_rehash = false;
+
+    // How Network runs layers over a batch.
+    Execution execution = Execution::Sample;
+
+    Output output = Output::Identity;
+  };
+
+
+  // Thread private gradient, which is allocated row by row on demand.
+  // When a thread touches all rows, this is same as dense buffer.
+  template<typename T> class GradientBuffer {
   private:
-    T value;
-    std::atomic<T> grad;
-    std::unique_ptr<OptimizerClient<T>> opt;
-    T L1;
-    T L2;
+    static constexpr const auto npos = std::numeric_limits<std::size_t>::max();
+    std::size_t stride;
+    idx_t slot;    // [rows] -> position in gw and gb
+    idx_t touched; // rows which have slot
+    aligned_vector<T> gw; // [touched, stride]
+    aligned_vector<T> gb; // [touched]
   public:
-    Param() = delete;
-    Param(const std::shared_ptr<Optimizer<T>>& o) : Param{o, T{}} {}
-    Param(const std::shared_ptr<Optimizer<T>>& o, T v, T L1=0, T L2=0)
-      : value{v}, grad{}, opt{o->client()}, L1{L1}, L2{L2} {}
-    Param(const Param&) = delete;
-    Param(Param&&) = delete;
-    Param& operator=(const Param&) = default;
-    Param& operator=(Param&&) = default;
-    ~Param() = default;
-
-    void add_grad(T g){ grad.fetch_add(g + std::copysign(L1, value) + L2*value); }
-    const auto& operator()() const noexcept { return value; }
-    void update(){ value += opt->diff(grad.exchange(0)); }
+    GradientBuffer() = delete;
+    GradientBuffer(std::size_t rows, std::size_t stride)
+      : stride{stride}, slot(rows, npos), touched{}, gw{}, gb{} {}
+    GradientBuffer(const GradientBuffer&) = default;
+    GradientBuffer(GradientBuffer&&) = default;
+    GradientBuffer& operator=(const GradientBuffer&) = default;
+    GradientBuffer& operator=(GradientBuffer&&) = default;
+    ~GradientBuffer() = default;
+
+    std::size_t find(std::size_t n){
+      if(slot[n] == npos){
+	slot[n] = touched.size();
+	touched.push_back(n);
+	if(gw.size() < touched.size() * stride){
+	  gw.resize(touched.size() * stride, T{0});
+	  gb.resize(touched.size(), T{0});
+	}
+      }
+      return slot[n];
+    }
+
+    T* weight(std::size_t n){
+      const auto s = find(n);
+      return gw.data() + s * stride;
+    }
+    T& bias(std::size_t n){
+      const auto s = find(n);
+      return gb[s];
+    }
+
+    bool contains(std::size_t n) const noexcept { return slot[n] != npos; }
+    const idx_t& rows() const noexcept { return touched; }
+
+    // Move gradient of row n into (gw_n, gb_n) and leave 0
+    void flush(std::size_t n, T* gw_n, T& gb_n, std::size_t cols){
+      const auto s = slot[n];
+      auto g = gw.data() + s * stride;
+      for(std::size_t i=0; i<cols; ++i){
+	gw_n[i] += g[i];
+	g[i] = T{0};
+      }
+      gb_n += std::exchange(gb[s], T{0});
+    }
+
+    // Release slots, but keep (zero filled) memory for reuse.
+    void clear() noexcept {
+      for(auto n : touched){ slot[n] = npos; }
+      touched.clear();
+    }
   };
 
 
-  template<typename T> class Weight {
+  template<typename T> class ParamStore {
   private:
-    using Param_t = std::unique_ptr<Param<T>>;
-    std::vector<Param_t> w;
-    Param_t b;
+    std::size_t _rows;
+    std::size_t _cols;
+    std::size_t _stride;
+    std::shared_ptr<Optimizer<T>> opt;
+    aligned_vector<T> w;  // [rows, stride] (row-major, padded)
+    aligned_vector<T> b;  // [rows]
+    aligned_vector<T> gw; // [rows, stride]
+    aligned_vector<T> gb; // [rows]
+    aligned_vector<T> mw; // Optimizer states, empty unless required
+    aligned_vector<T> mb;
+    aligned_vector<T> vw;
+    aligned_vector<T> vb;
+    std::vector<std::uintmax_t> last; // Last updated step (only for lazy optimizer)
+    T L1;
+    T L2;
+    std::unique_ptr<PerThread<GradientBuffer<T>>> local; // Only for GradientMode::PerThread
+    IndexSet reduce_rows;
+    std::unique_ptr<PerThread<aligned_vector<T>>> hogwild; // Only for GradientMode::Hogwild
+
+    T regularize(T v, T dg) const noexcept { return dg + std::copysign(L1, v) + L2*v; }
+
+    void add(T& g, T v, T dg){
+      std::atomic_ref<T>{g}.fetch_add(regularize(v, dg));
+    }
+
+    auto& buffer(){
+      return local->local([this](){ return GradientBuffer<T>{this->_rows, this->_stride}; });
+    }
+
+    // Sum up thread private gradients into shared gradient block.
+    void reduce(){
+      if(!local){ return; }
+
+      std::vector<GradientBuffer<T>*> buffers{};
+      buffers.reserve(local->size());
+      local->for_each([&](auto& buf){
+	buffers.push_back(&buf);
+	for(auto n : buf.rows()){ this->reduce_rows.insert(n); }
+      });
+
+      const auto rows = reduce_rows.indices();
+      std::for_each(std::execution::par, rows.begin(), rows.end(), [&, this](auto n){
+	for(auto buf : buffers){
+	  if(buf->contains(n)){
+	    buf->flush(n, this->gw.data() + n * this->_stride, this->gb[n], this->_cols);
+	  }
+	}
+      });
+
+      for(auto buf : buffers){ buf->clear(); }
+      reduce_rows.clear();
+    }
+
+    static auto span(aligned_vector<T>& v, std::size_t offset, std::size_t size){
+      return v.empty() ? std::span<T>{} : std::span<T>{v.data() + offset, size};
+    }
+
+    void update_weight(std::size_t n){
+      const auto offset = n * _stride;
+      opt->update(span(w, offset, _cols), span(gw, offset, _cols),
+		  span(mw, offset, _cols), span(vw, offset, _cols));
+    }
+
+    void catch_up(std::size_t n){
+      const auto t = opt->steps();
+      // Exchange, so that only one thread catches up under Hogwild
+      const auto prev = std::atomic_ref<std::uintmax_t>{last[n]}.exchange(t);
+      const auto skipped = (t > prev + 1) ? t - prev - 1 : 0;
+      const auto offset = n * _stride;
+      opt->catch_up(span(mw, offset, _cols), span(vw, offset, _cols), skipped);
+      opt->catch_up(span(mb, n, 1), span(vb, n, 1), skipped);
+    }
+
+    // Hogwild: update row n with thread local gradient g at idx.
+    // Other threads may read and write the same row at the same time.
+    void apply(std::size_t n, std::span<T> g, std::span<const std::size_t> idx){
+      const auto offset = n * _stride;
+      if(!last.empty()){
+	// Lazy steps are counted by row, so that the whole row takes this step.
+	catch_up(n);
+	return opt->update(span(w, offset, _cols), g.first(_cols),
+			   span(mw, offset, _cols), span(vw, offset, _cols));
+      }
+
+      opt->update(span(w, offset, _cols), g,
+		  span(mw, offset, _cols), span(vw, offset, _cols), idx);
+    }
+
+    void apply_bias(std::size_t n, T g){
+      opt->update(span(b, n, 1), std::span<T>{&g, 1}, span(mb, n, 1), span(vb, n, 1));
+    }
+
+    auto& scratch(){
+      // Optimizer resets used elements to 0, so that this is always 0 filled.
+      return hogwild->local([this](){ return aligned_vector<T>(this->_stride, T{0}); });
+    }
   public:
-    Weight() = delete;
-    Weight(std::size_t N, const std::shared_ptr<Optimizer<T>>& o, T L1=0, T L2=0)
-      : w{}, b{new Param<T>{o, T{0}, L1, L2}}
+    ParamStore() = delete;
+    ParamStore(std::size_t rows, std::size_t cols,
+	       const std::shared_ptr<Optimizer<T>>& o, T L1=0, T L2=0,
+	       GradientMode mode = GradientMode::Atomic)
+      : _rows{rows}, _cols{cols}, _stride{aligned_stride<T>(cols)}, opt{o},
+	w(rows * _stride, T{0}), b(rows, T{0}),
+	gw(rows * _stride, T{0}), gb(rows, T{0}),
+	mw{}, mb{}, vw{}, vb{}, last{}, L1{L1}, L2{L2},
+	local{mode == GradientMode::PerThread ? new PerThread<GradientBuffer<T>>{} : nullptr},
+	reduce_rows{local ? rows : 0},
+	hogwild{mode == GradientMode::Hogwild ? new PerThread<aligned_vector<T>>{} : nullptr}
     {
-      w.reserve(N);
-      std::generate_n(std::back_inserter(w), N,
-		      [&](){ return Param_t{new Param<T>{o, T{0}, L1, L2}}; });
+      if(opt->lazy()){ last.resize(rows, opt->steps()); }
+
+      const auto state = opt->state_size();
+      if(state > 0){
+	mw.resize(w.size(), T{0});
+	mb.resize(b.size(), T{0});
+      }
+      if(state > 1){
+	vw.resize(w.size(), T{0});
+	vb.resize(b.size(), T{0});
+      }
     }
-    Weight(std::size_t N, const std::shared_ptr<Optimizer<T>>& o,
-	   std::shared_ptr<Initializer<T>> f, T L1=0, T L2=0)
-      : w{}, b{new Param<T>{o, T{}, L1, L2}}
+    ParamStore(std::size_t rows, std::size_t cols,
+	       const std::shared_ptr<Optimizer<T>>& o,
+	       std::shared_ptr<Initializer<T>> f, T L1=0, T L2=0,
+	       GradientMode mode = GradientMode::Atomic)
+      : ParamStore{rows, cols, o, L1, L2, mode}
     {
-      w.reserve(N);
-      std::generate_n(std::back_inserter(w), N,
-		      [&](){ return Param_t{new Param<T>{o, (*f)(), L1, L2}}; });
+      for(std::size_t n=0; n<_rows; ++n){
+	std::generate_n(weight(n), _cols, [&](){ return (*f)(); });
+      }
+    }
+    ParamStore(const ParamStore&) = delete;
+    ParamStore(ParamStore&&) = default;
+    ParamStore& operator=(const ParamStore&) = delete;
+    ParamStore& operator=(ParamStore&&) = default;
+    ~ParamStore() = default;
+
+    auto rows() const noexcept { return _rows; }
+    auto cols() const noexcept { return _cols; }
+    auto stride() const noexcept { return _stride; }
+
+    T* weight(std::size_t n) noexcept { return w.data() + n * _stride; }
+    const T* weight(std::size_t n) const noexcept { return w.data() + n * _stride; }
+    auto weight(std::size_t n, std::size_t i) const noexcept { return weight(n)[i]; }
+    auto bias(std::size_t n) const noexcept { return b[n]; }
+
+    bool is_hogwild() const noexcept { return bool(hogwild); }
+
+    void add_weight_grad(std::size_t n, std::size_t i, T g){
+      if(hogwild){
+	auto& gn = scratch();
+	gn[i] = regularize(weight(n, i), g);
+	apply(n, gn, std::span<const std::size_t>{&i, 1});
+      } else if(local){
+	buffer().weight(n)[i] += regularize(weight(n, i), g);
+      } else {
+	add(gw[n * _stride + i], weight(n, i), g);
+      }
+    }
+    void add_bias_grad(std::size_t n, T g){
+      if(hogwild){
+	apply_bias(n, regularize(b[n], g));
+      } else if(local){
+	buffer().bias(n) += regularize(b[n], g);
+      } else {
+	add(gb[n], b[n], g);
+      }
+    }
+
+    // Accumulate gradient of row n: dL/dw_i = g * x(j) (i = idx[j]), dL/db = g
+    template<typename F>
+    void add_grad(std::size_t n, std::span<const std::size_t> idx, F&& x, T g){
+      const auto wn = weight(n);
+      const auto size = idx.size();
+      if(hogwild){
+	auto& gn = scratch();
+	// Accumulate, so that duplicated indices sum up as the other modes.
+	for(std::size_t j=0; j<size; ++j){ gn[idx[j]] += regularize(wn[idx[j]], g * x(j)); }
+	apply(n, gn, idx);
+	apply_bias(n, regularize(b[n], g));
+      } else if(local){
+	auto& buf = buffer();
+	auto gn = buf.weight(n);
+	for(std::size_t j=0; j<size; ++j){ gn[idx[j]] += regularize(wn[idx[j]], g * x(j)); }
+	buf.bias(n) += regularize(b[n], g);
+      } else {
+	auto gn = gw.data() + n * _stride;
+	for(std::size_t j=0; j<size; ++j){ add(gn[idx[j]], wn[idx[j]], g * x(j)); }
+	add(gb[n], b[n], g);
+      }
+    }
+
+    // Dense X indexed by prev_active
+    void add_grad(std::size_t n, const Data<T>& X, const idx_t& prev_active, T g){
+      add_grad(n, prev_active, [&](auto j){ return X[prev_active[j]]; }, g);
+    }
+
+    // Sparse x of values aligned with idx
+    void add_grad(std::size_t n, std::span<const std::size_t> idx,
+		  std::span<const T> value, T g){
+      add_grad(n, idx, [&](auto j){ return value[j]; }, g);
+    }
+
+    void update(std::size_t n){
+      reduce();
+      if(!last.empty()){ catch_up(n); }
+      update_weight(n);
+      opt->update(span(b, n, 1), span(gb, n, 1), span(mb, n, 1), span(vb, n, 1));
+    }
+
+    void update(){
+      reduce();
+      if(_cols == _stride){
+	opt->update(span(w, 0, w.size()), span(gw, 0, gw.size()),
+		    span(mw, 0, mw.size()), span(vw, 0, vw.size()));
+      } else {
+	// Skip padding columns
+	auto idx = index_vec(_rows);
+	std::for_each(std::execution::par, idx.begin(), idx.end(),
+		      [this](auto n){ this->update_weight(n); });
+      }
+      opt->update(span(b, 0, b.size()), span(gb, 0, gb.size()),
+		  span(mb, 0, mb.size()), span(vb, 0, vb.size()));
+      std::fill(last.begin(), last.end(), opt->steps());
+    }
+
+    // Update only rows and columns which received gradient
+    void update(const IndexSet& rows, const IndexSet& cols){
+      if(rows.full()){
+	if(cols.full()){ return update(); }
+	auto idx = index_vec(_rows);
+	return update(idx, cols);
+      }
+      update(rows.indices(), cols);
+    }
+
+    // Lazy optimizer updates whole rows, since skipped steps are counted by row.
+    void update(std::span<const std::size_t> rows, const IndexSet& cols){
+      reduce();
+      std::for_each(std::execution::par, rows.begin(), rows.end(), [&, this](auto n){
+	if(!this->last.empty()){ this->catch_up(n); }
+
+	if(cols.full() || !this->last.empty()){
+	  this->update_weight(n);
+	} else {
+	  const auto offset = n * this->_stride;
+	  this->opt->update(span(this->w, offset, this->_cols),
+			    span(this->gw, offset, this->_cols),
+			    span(this->mw, offset, this->_cols),
+			    span(this->vw, offset, this->_cols),
+			    cols.indices());
+	}
+	this->opt->update(span(this->b, n, 1), span(this->gb, n, 1),
+			  span(this->mb, n, 1), span(this->vb, n, 1));
+      });
     }
+  };
+
+
+  template<typename T> class Weight {
+  private:
+    ParamStore<T>* P;
+    std::size_t n;
+  public:
+    Weight() = delete;
+    Weight(ParamStore<T>& P, std::size_t n): P{&P}, n{n} {}
     Weight(const Weight&) = default;
     Weight(Weight&&) = default;
     Weight& operator=(const Weight&) = default;
@@ -68,25 +421,41 @@ namespace HashDL {
     ~Weight() = default;
 
     auto weight() const noexcept {
-      return Data<T>{w.begin(), w.end(), [](auto& wi){ return (*wi)(); }};
+      const auto w = P->weight(n);
+      return Data<T>{w, w + P->cols()};
     }
-    auto weight(std::size_t i) const { return (*w[i])(); }
-    auto bias() const noexcept { return (*b)(); }
+    auto weight(std::size_t i) const { return P->weight(n, i); }
+    auto bias() const noexcept { return P->bias(n); }
 
-    void update(){
-      for(auto& wi : w){ wi->update(); }
-      b->update();
-    }
+    void update(){ P->update(n); }
 
-    void add_weight_grad(std::size_t i, T g){ w[i]->add_grad(g); }
-    void add_bias_grad(T g){ b->add_grad(g); }
+    void add_weight_grad(std::size_t i, T g){ P->add_weight_grad(n, i, g); }
+    void add_bias_grad(T g){ P->add_bias_grad(n, g); }
+    void add_grad(const Data<T>& X, const idx_t& prev_active, T g){
+      P->add_grad(n, X, prev_active, g);
+    }
+    void add_grad(std::span<const std::size_t> idx, std::span<const T> value, T g){
+      P->add_grad(n, idx, value, g);
+    }
 
     auto affine(const Data<T>& X, const idx_t& prev_active) const {
-      auto result = (*b)();
-      for(auto i : prev_active){
-	result += (*w[i])()*X[i];
-      }
-      return result;
+      const auto w = P->weight(n);
+      const auto x = std::to_address(X.begin());
+
+      // prev_active covers the whole previous layer (e.g. InputLayer)
+      if(prev_active.size() == P->cols()){ return P->bias(n) + kernel::dot(w, x, P->cols()); }
+
+      return P->bias(n) + kernel::gather_dot(w, prev_active.data(), x, prev_active.size());
+    }
+
+    // dL_dx[j] += g * w_i (i = idx[j])
+    void propagate(std::span<const std::size_t> idx, T g, T* dL_dx) const {
+      kernel::gather_axpy(g, P->weight(n), idx.data(), dL_dx, idx.size());
+    }
+
+    // Sparse x of values aligned with idx
+    auto affine(std::span<const std::size_t> idx, std::span<const T> value) const {
+      return P->bias(n) + kernel::sparse_dot(P->weight(n), idx.data(), value.data(), idx.size());
     }
   };
 
@@ -95,34 +464,72 @@ namespace HashDL {
   private:
     Weight<T> weight;
   public:
-    Neuron(): Neuron{16, new Adam<T>{}} {}
-    Neuron(std::size_t prev_units,
-	   const std::shared_ptr<Optimizer<T>>& optimizer,
-	   std::shared_ptr<Initializer<T>> weight_initializer = std::shared_ptr<Initializer<T>>{new ConstantInitializer<T>{0}}, T L1=0, T L2=0)
-      : weight{prev_units, optimizer, weight_initializer, L1, L2} {}
+    Neuron() = delete;
+    Neuron(ParamStore<T>& P, std::size_t n): weight{P, n} {}
     Neuron(const Neuron&) = default;
     Neuron(Neuron&&) = default;
     Neuron& operator=(const Neuron&) = default;
     Neuron& operator=(Neuron&&) = default;
     ~Neuron() = default;
 
+    // f is an activation pointer, either std::shared_ptr<Activation<T>> (virtual)
+    // or a pointer to final activation class (inlined).
+    template<typename F>
     const auto forward(const Data<T>& X,
 		       const idx_t& prev_active,
-		       const std::shared_ptr<Activation<T>>& f){
+		       const F& f){
       return f->call(weight.affine(X, prev_active));
     }
 
+    template<typename F>
     const auto backward(const Data<T>& X, T y,
 			T dL_dy, Data<T>& dL_dx,
 			const idx_t& prev_active,
-			const std::shared_ptr<Activation<T>>& f){
+			const F& f){
       dL_dy = f->back(y, dL_dy);
 
       for(auto i : prev_active){
 	dL_dx[i] += dL_dy * weight.weight(i);
-	weight.add_weight_grad(i, dL_dy * X[i]);
       }
-      weight.add_bias_grad(dL_dy);
+      weight.add_grad(X, prev_active, dL_dy);
+    }
+
+    // Without propagation (e.g. to input layer)
+    template<typename F>
+    void backward(const Data<T>& X, T y, T dL_dy, const idx_t& prev_active,
+		  const F& f){
+      weight.add_grad(X, prev_active, f->back(y, dL_dy));
+    }
+
+    // Sparse input. (Input layer doesn't need gradient)
+    template<typename F>
+    const auto forward(std::span<const std::size_t> idx, std::span<const T> value,
+		       const F& f){
+      return f->call(weight.affine(idx, value));
+    }
+
+    template<typename F>
+    void backward(std::span<const std::size_t> idx, std::span<const T> value,
+		  T y, T dL_dy, const F& f){
+      weight.add_grad(idx, value, f->back(y, dL_dy));
+    }
+
+    // Sparse input with propagation to dL_dx aligned with idx (not indexed by idx)
+    template<typename F>
+    void backward(std::span<const std::size_t> idx, std::span<const T> value,
+		  T y, T dL_dy, T* dL_dx, const F& f){
+      dL_dy = f->back(y, dL_dy);
+      weight.propagate(idx, dL_dy, dL_dx);
+      weight.add_grad(idx, value, dL_dy);
+    }
+
+    // Dense input with propagation to dL_dx aligned with prev_active
+    template<typename F>
+    void backward(const Data<T>& X, T y, T dL_dy, const idx_t& prev_active,
+		  T* dL_dx, const F& f){
+      dL_dy = f->back(y, dL_dy);
+      weight.propagate(prev_active, dL_dy, dL_dx);
+      weight.add_grad(X, prev_active, dL_dy);
     }
 
     const auto w() const noexcept { return weight.weight(); }
@@ -137,22 +544,85 @@ namespace HashDL {
     std::shared_ptr<HashFunc<T>> hash_factory;
     using hash_ptr = std::unique_ptr<Hash<T>>;
     std::vector<hash_ptr> hash;
-    std::vector<std::unordered_multimap<hashcode_t, std::size_t>> backet;
+    std::shared_ptr<TableFunc> table_factory;
+    using table_ptr = std::unique_ptr<HashTable>;
+    std::vector<table_ptr> backet;
+    std::vector<hashcode_t> neuron_code; // [neuron_size, L]
     idx_t idx;
     std::size_t neuron_size;
     T sparsity;
-    std::mt19937 g;
+    Retrieval retrieval;
+    std::size_t min_votes;
+    std::size_t probes;
+
+    // Reusable per-thread state of retrieve
+    struct Scratch {
+      VoteCounter votes;
+      idx_t order; // Table order for Retrieval::Union
+      std::vector<hashcode_t> codes; // Probed codes
+      std::mt19937 g;
+      std::vector<T> dense; // Scattered sparse input
+      std::vector<std::uint32_t> weight_order; // top_support() of weights
+    };
+    mutable PerThread<Scratch> scratch;
+
+    Scratch& thread_scratch() const {
+      return scratch.local([this](){
+	return Scratch{VoteCounter{neuron_size}, index_vec(L),
+		       std::vector<hashcode_t>(probes), std::mt19937{std::random_device{}()},
+		       std::vector<T>{}, std::vector<std::uint32_t>{}};
+      });
+    }
+
+    Scratch& local() const {
+      auto& s = thread_scratch();
+      if(s.votes.capacity() < neuron_size){ s.votes.resize(neuron_size); }
+      s.votes.begin();
+      return s;
+    }
+
+    // For hash encoding weights by their top-k support (e.g. DOPH),
+    // select support of each row once, instead of at every table.
+    // support [rows.size(), k] and count [rows.size()] are written, and k is returned.
+    // Return 0 (nothing written) for hash encoding whole weights.
+    std::size_t weight_support(const ParamStore<T>& P, std::span<const std::size_t> rows,
+			       std::vector<std::size_t>& support,
+			       std::vector<std::size_t>& count) const {
+      const auto k = hash.front()->weight_support();
+      if(k == 0){ return 0; }
+
+      support.resize(rows.size() * k);
+      count.resize(rows.size());
+      const auto pos = index_vec(rows.size());
+      std::for_each(std::execution::par, pos.begin(), pos.end(),
+		    [&,k,this](auto j){
+		      auto& order = this->thread_scratch().weight_order;
+		      count[j] = top_support(P.weight(rows[j]), this->data_size, k,
+					     order, support.data() + j * k);
+		    });
+      return k;
+    }
   public:
     LSH(): LSH(50, 1, std::shared_ptr<HashFunc<T>>(new DWTAFunc<T>{8, 8})) {}
     LSH(std::size_t L, std::size_t data_size,
 	std::shared_ptr<HashFunc<T>> hash_factory,
-	T sparsity = 0.5)
-      : L{L}, data_size{data_size}, hash_factory{hash_factory}, hash{}, backet(L),
-	idx{index_vec(L)}, neuron_size{}, sparsity{sparsity}, g{std::random_device{}()}
+	T sparsity = 0.5,
+	std::shared_ptr<TableFunc> table_factory = std::shared_ptr<TableFunc>{},
+	Retrieval retrieval = Retrieval::Union, std::size_t min_votes = 2,
+	std::size_t probes = 1)
+      : L{L}, data_size{data_size}, hash_factory{hash_factory}, hash{},
+	table_factory{table_factory ? table_factory : std::shared_ptr<TableFunc>{new MapTableFunc{}}},
+	backet{}, neuron_code{}, idx{index_vec(L)}, neuron_size{}, sparsity{sparsity},
+	retrieval{retrieval}, min_votes{min_votes}, probes{std::max<std::size_t>(probes, 1)},
+	scratch{}
     {
       hash.reserve(L);
       std::generate_n(std::back_inserter(hash), L,
 		      [&](){ return hash_ptr{hash_factory->GetHash(data_size)}; });
+
+      backet.reserve(L);
+      std::generate_n(std::back_inserter(backet), L,
+		      [this](){ return table_ptr{this->table_factory->GetTable()}; });
     }
     LSH(const LSH&) = default;
     LSH(LSH&&) = default;
@@ -163,39 +633,159 @@ namespace HashDL {
     void reset(){
       for(auto& h : hash){ h.reset(hash_factory->GetHash(data_size)); }
 
-      backet.clear();
-      backet.resize(L);
+      for(auto& b : backet){ b->clear(); }
+      neuron_code.clear();
 
       neuron_size = 0;
     }
 
-    void add(const std::vector<Neuron<T>>& N){
+    void add(const ParamStore<T>& P){
+      const auto rows = P.rows();
+      if(rows > std::numeric_limits<neuron_t>::max()){
+	throw std::runtime_error("Too many neurons for hash table");
+      }
+      neuron_code.resize(rows * L);
+
+      const auto all = index_vec(rows);
+      std::vector<std::size_t> support, count;
+      const auto k = weight_support(P, all, support, count);
+
       std::for_each(std::execution::par, idx.begin(), idx.end(),
-		    [&N,this](auto i){
-		      for(std::size_t n=0, size=N.size(); n<size; ++n){
-			this->backet[i].emplace(this->hash[i]->encode(N[n].w()), n);
+		    [&,rows,k,this](auto i){
+		      std::vector<hashcode_t> codes(rows);
+		      if(k){
+			for(std::size_t n=0; n<rows; ++n){
+			  codes[n] = this->hash[i]->encode({support.data() + n * k, count[n]}, {});
+			}
+		      }else{
+			this->hash[i]->encode_weight(P.weight(0), rows, P.stride(), codes.data());
+		      }
+		      for(std::size_t n=0; n<rows; ++n){
+			this->backet[i]->insert(codes[n], n);
+			this->neuron_code[n * this->L + i] = codes[n];
 		      }
 		    });
-      neuron_size = N.size();
+      neuron_size = rows;
     }
 
-    auto retrieve(const Data<T>& X) {
+    hashcode_t code(std::size_t n, std::size_t i) const noexcept { return neuron_code[n * L + i]; }
+    std::size_t size(std::size_t i) const noexcept { return backet[i]->size(); }
+
+    // Re-encode rows of P with the current hash functions,
+    // and move only entries whose codes changed.
+    void update(const ParamStore<T>& P, std::span<const std::size_t> rows){
+      std::vector<std::size_t> support, count;
+      const auto k = weight_support(P, rows, support, count);
+
+      std::for_each(std::execution::par, idx.begin(), idx.end(),
+		    [&,rows,k,this](auto i){
+		      auto& table = this->backet[i];
+		      for(std::size_t j=0; j<rows.size(); ++j){
+			const auto n = rows[j];
+			const auto c = k ?
+			  this->hash[i]->encode({support.data() + j * k, count[j]}, {}) :
+			  this->hash[i]->encode_weight(P.weight(n));
+			auto& old = this->neuron_code[n * this->L + i];
+			if(c == old){ continue; }
+
+			table->erase(old, n);
+			table->insert(c, n);
+			old = c;
+		      }
+		    });
+    }
+
+    void update(const ParamStore<T>& P){
+      const auto rows = index_vec(P.rows());
+      update(P, rows);
+    }
+
+    // Select active neurons by voting of tables into neuron_id.
+    // vote(hid, votes, codes) votes neurons colliding at table hid.
+    template<typename V> void select(V&& vote, idx_t& neuron_id) const {
       const auto th = std::max<std::size_t>(neuron_size*sparsity,1);
-      auto hash_idx = index_vec(L);
-      std::shuffle(hash_idx.begin(), hash_idx.end(), g);
+      auto& s = local();
+      auto& votes = s.votes;
 
-      std::unordered_set<std::size_t> neuron_id{};
-      for(auto hid : hash_idx){
-	auto [begin, end] = backet[hid].equal_range(hash[hid]->encode(X));
+      neuron_id.clear();
+      if(retrieval == Retrieval::Union){
+	std::shuffle(s.order.begin(), s.order.end(), s.g);
 
-	std::for_each(begin, end, [&](auto v){
-	  neuron_id.insert(v.second);
-	});
+	for(auto hid : s.order){
+	  vote(hid, votes, s.codes);
+	  if(votes.size() >= th){ break; }
+	}
+
+	auto c = votes.candidates();
+	neuron_id.assign(c.begin(), c.end());
+	return;
+      }
+
+      for(std::size_t hid=0; hid<L; ++hid){ vote(hid, votes, s.codes); }
+
+      if(retrieval == Retrieval::TopK){
+	auto c = votes.top(th);
+	neuron_id.assign(c.begin(), c.end());
+	return;
+      }
+
+      for(auto n : votes.candidates()){
+	if(votes.votes(n) >= min_votes){ neuron_id.push_back(n); }
+      }
+    }
+
+    // Retrieval is thread safe, but not concurrently with add, update or reset.
+    void retrieve(const T* x, idx_t& neuron_id) const {
+      select([x, this](auto hid, auto& votes, auto& codes){
+	if(probes == 1){
+	  for(auto n : backet[hid]->find(hash[hid]->encode(x))){ votes.add(n); }
+	  return;
+	}
+
+	const auto m = hash[hid]->probe(x, probes, codes.data());
+	for(std::size_t j=0; j<m; ++j){
+	  for(auto n : backet[hid]->find(codes[j])){ votes.add(n); }
+	}
+      }, neuron_id);
+    }
+
+    // Write active neurons for X into neuron_id.
+    // No heap allocation after neuron_id and per-thread scratch are warmed up.
+    void retrieve(const Data<T>& X, idx_t& neuron_id) const {
+      if(X.size() != data_size){ throw std::runtime_error("Data size mismuch!"); }
+      retrieve(std::to_address(X.begin()), neuron_id);
+    }
 
-	if(neuron_id.size() >= th){ break; }
+    // Sparse X given by nonzero indices and aligned values.
+    void retrieve(std::span<const std::size_t> idx, std::span<const T> value,
+		  idx_t& neuron_id) const {
+      if(hash.front()->sparse()){
+	select([&, this](auto hid, auto& votes, auto& codes){
+	  if(probes == 1){
+	    for(auto n : backet[hid]->find(hash[hid]->encode(idx, value))){ votes.add(n); }
+	    return;
+	  }
+
+	  const auto m = hash[hid]->probe(idx, value, probes, codes.data());
+	  for(std::size_t j=0; j<m; ++j){
+	    for(auto n : backet[hid]->find(codes[j])){ votes.add(n); }
+	  }
+	}, neuron_id);
+	return;
       }
 
-      return std::vector<std::size_t>(neuron_id.begin(), neuron_id.end());
+      // Scatter into per-thread dense buffer for hash without sparse support.
+      auto& dense = local().dense;
+      if(dense.size() != data_size){ dense.assign(data_size, T{0}); }
+      for(std::size_t j=0; j<idx.size(); ++j){ dense[idx[j]] = value[j]; }
+      retrieve(dense.data(), neuron_id);
+      for(auto i : idx){ dense[i] = T{0}; }
+    }
+
+    auto retrieve(const Data<T>& X) const {
+      idx_t neuron_id{};
+      retrieve(X, neuron_id);
+      return neuron_id;
     }
   };
 
@@ -204,20 +794,55 @@ namespace HashDL {
   private:
     std::weak_ptr<Layer<T>> _next;
     std::weak_ptr<Layer<T>> _prev;
+    // Not owning. Network owns all layers, so that these outlive hot path.
+    Layer<T>* _next_ptr = nullptr;
+    Layer<T>* _prev_ptr = nullptr;
   protected:
     std::vector<Data<T>> Y;
+    std::vector<Data<T>> dY; // dL/dY aligned with active_id
   public:
     auto next() const noexcept { return _next.lock(); }
     auto prev() const noexcept { return _prev.lock(); }
-    void set_next(const std::shared_ptr<Layer<T>>& L){ _next = L; }
-    void set_prev(const std::shared_ptr<Layer<T>>& L){ _prev = L; }
+    Layer<T>* next_layer() const noexcept { return _next_ptr; }
+    Layer<T>* prev_layer() const noexcept { return _prev_ptr; }
+    void set_next(const std::shared_ptr<Layer<T>>& L){ _next = L; _next_ptr = L.get(); }
+    void set_prev(const std::shared_ptr<Layer<T>>& L){ _prev = L; _prev_ptr = L.get(); }
+    // Dense value. Not available when sparse(batch_i)
     const Data<T>& fx(std::size_t batch_i) const { return Y[batch_i]; }
+    // Gradient buffer aligned with active_id(batch_i), which is written
+    // by next layer. Empty when the layer doesn't need gradient.
+    Data<T>& grad(std::size_t batch_i){ return dY[batch_i]; }
+    bool has_grad() const noexcept { return !dY.empty(); }
+
+    // Layer-wise execution: compute only this layer for batch_i
+    // from prev_layer()'s fx, or propagate grad(batch_i) into prev_layer()'s.
+    virtual void forward(std::size_t /* batch_i */){}
+    virtual void backward(std::size_t /* batch_i */){}
     virtual Data<T> forward(std::size_t, const Data<T>&) = 0;
+    virtual Data<T> forward(std::size_t, std::span<const std::size_t>, std::span<const T>){
+      throw std::runtime_error("Sparse input is not supported");
+    }
+    // dL/dy is aligned with active_id(batch_i)
     virtual void backward(std::size_t, const Data<T>&) = 0;
     virtual const idx_t& active_id(std::size_t) const = 0;
+    // Whether fx(batch_i) is given by active_id(batch_i) and active_value(batch_i)
+    virtual bool sparse(std::size_t) const noexcept { return false; }
+    virtual std::span<const T> active_value(std::size_t) const { return {}; }
+    // Neurons of prev_layer() which must be active for batch_i
+    // in addition to retrieved ones (e.g. true labels)
+    virtual std::span<const std::size_t> required_id(std::size_t) const { return {}; }
+    // Prepare buffers for batch_size. Buffers only grow and are reused across batches.
     virtual void reset(std::size_t batch_size){
-      Y.clear();
-      Y.resize(batch_size);
+      if(Y.size() < batch_size){ Y.resize(batch_size); }
+    }
+    // Read-only inference of a single sample from the previous layer's
+    // (dense x) or (idx, value) into (active, y). Thread safe.
+    virtual void predict(const T*, idx_t&, std::vector<T>&) const {
+      throw std::runtime_error("Inference is not supported");
+    }
+    virtual void predict(std::span<const std::size_t>, std::span<const T>,
+			 idx_t&, std::vector<T>&) const {
+      throw std::runtime_error("Inference is not supported");
     }
     virtual void update(bool){}
     virtual std::string to_string() const {
@@ -232,9 +857,13 @@ namespace HashDL {
   template<typename T> class InputLayer : public Layer<T> {
   private:
     idx_t idx;
+    std::vector<idx_t> sparse_idx;
+    std::vector<std::vector<T>> sparse_value;
+    std::vector<std::uint8_t> is_sparse;
   public:
     InputLayer() = default;
-    InputLayer(std::size_t units): idx{index_vec(units)} {}
+    InputLayer(std::size_t units)
+      : idx{index_vec(units)}, sparse_idx{}, sparse_value{}, is_sparse{} {}
     InputLayer(const InputLayer&) = default;
     InputLayer(InputLayer&&) = default;
     InputLayer& operator=(const InputLayer&) = default;
@@ -246,9 +875,48 @@ namespace HashDL {
       return this->next()->forward(batch_i, X);
     }
 
+    Data<T> forward(std::size_t batch_i, std::span<const std::size_t> i,
+		    std::span<const T> v) override {
+      // Keep nonzeros (instead of dense fx) for backward.
+      is_sparse[batch_i] = 1;
+      sparse_idx[batch_i].assign(i.begin(), i.end());
+      sparse_value[batch_i].assign(v.begin(), v.end());
+      return this->next()->forward(batch_i, sparse_idx[batch_i], sparse_value[batch_i]);
+    }
+
+    // Layer-wise input
+    void set(std::size_t batch_i, const T* begin, const T* end){
+      this->Y[batch_i].assign(begin, end);
+    }
+
+    void set(std::size_t batch_i, std::span<const std::size_t> i, std::span<const T> v){
+      is_sparse[batch_i] = 1;
+      sparse_idx[batch_i].assign(i.begin(), i.end());
+      sparse_value[batch_i].assign(v.begin(), v.end());
+    }
+
     void backward(std::size_t /* batch_i */, const Data<T>& /* dL_dy */) override {}
 
-    const idx_t& active_id(std::size_t /* batch_i */) const override { return idx; }
+    void reset(std::size_t batch_size) override {
+      Layer<T>::reset(batch_size);
+      if(sparse_idx.size() < batch_size){
+	sparse_idx.resize(batch_size);
+	sparse_value.resize(batch_size);
+      }
+      is_sparse.assign(batch_size, 0);
+    }
+
+    const idx_t& active_id(std::size_t batch_i) const override {
+      return is_sparse[batch_i] ? sparse_idx[batch_i]: idx;
+    }
+
+    bool sparse(std::size_t batch_i) const noexcept override {
+      return is_sparse[batch_i];
+    }
+
+    std::span<const T> active_value(std::size_t batch_i) const override {
+      return sparse_value[batch_i];
+    }
   };
 
 
@@ -269,21 +937,132 @@ namespace HashDL {
       return X;
     }
 
+    // Value of outputs which the sparse last hidden layer didn't compute
+    virtual T missing() const noexcept { return T{0}; }
+
+    // Densify sparse activation of the last hidden layer
+    Data<T> forward(std::size_t batch_i, std::span<const std::size_t> i,
+		    std::span<const T> v) override {
+      auto& y = this->Y[batch_i];
+      if(y.size() != idx.size()){ y = Data<T>(idx.size()); }
+      std::fill(y.begin(), y.end(), missing());
+      for(std::size_t j=0; j<i.size(); ++j){ y[i[j]] = v[j]; }
+      return y;
+    }
+
     void backward(std::size_t batch_i, const Data<T>& dL_dy) override {
-      this->prev()->backward(batch_i, dL_dy);
+      const auto p = this->prev();
+      if(!p->has_grad()){ return p->backward(batch_i, Data<T>{0}); }
+
+      set_grad(batch_i, std::to_address(dL_dy.begin()));
+      p->backward(batch_i, p->grad(batch_i));
+    }
+
+    // Layer-wise output. Identity, so that prev_layer()'s value is read directly
+    // into out.
+    void get(std::size_t batch_i, T* out) const {
+      const auto p = this->prev_layer();
+      if(p->sparse(batch_i)){
+	std::fill_n(out, idx.size(), missing());
+	const auto& i = p->active_id(batch_i);
+	const auto v = p->active_value(batch_i);
+	for(std::size_t j=0; j<i.size(); ++j){ out[i[j]] = v[j]; }
+	return;
+      }
+      const auto& X = p->fx(batch_i);
+      std::copy(X.begin(), X.end(), out);
+    }
+
+    // Gather dense dL_dy at active neurons of prev_layer() into its grad.
+    void set_grad(std::size_t batch_i, const T* dL_dy){
+      auto p = this->prev_layer();
+      if(!p->has_grad()){ return; }
+      const auto& active = p->active_id(batch_i);
+      auto& dy = p->grad(batch_i);
+      dy.assign(active.size(), T{0});
+      for(std::size_t j=0; j<active.size(); ++j){ dy[j] = dL_dy[active[j]]; }
     }
 
     const idx_t& active_id(std::size_t /* batch_i */) const override { return idx; }
   };
 
 
-  template<typename T> class DenseLayer : public Layer<T> {
+  // Output layer of softmax cross entropy over sampled classes.
+  // The previous layer gives logits for LSH retrieved classes, and computes
+  // true labels too (required_id), so that neither forward nor loss touches
+  // all classes. Without label, this works as OutputLayer (dense logits,
+  // -inf at unretrieved classes).
+  template<typename T> class SampledSoftmaxLayer : public OutputLayer<T> {
+  private:
+    std::vector<idx_t> label;
+    std::vector<std::uint8_t> has_label;
+    SparseSoftmaxCrossEntropy<T> loss_func;
+  public:
+    SampledSoftmaxLayer() = default;
+    SampledSoftmaxLayer(std::size_t units)
+      : OutputLayer<T>{units}, label{}, has_label{}, loss_func{} {}
+    SampledSoftmaxLayer(const SampledSoftmaxLayer&) = default;
+    SampledSoftmaxLayer(SampledSoftmaxLayer&&) = default;
+    SampledSoftmaxLayer& operator=(const SampledSoftmaxLayer&) = default;
+    SampledSoftmaxLayer& operator=(SampledSoftmaxLayer&&) = default;
+    ~SampledSoftmaxLayer() = default;
+
+    void set_label(std::size_t batch_i, std::span<const std::size_t> l){
+      has_label[batch_i] = 1;
+      label[batch_i].assign(l.begin(), l.end());
+    }
+
+    std::span<const std::size_t> required_id(std::size_t batch_i) const override {
+      if(!has_label[batch_i]){ return {}; }
+      return label[batch_i];
+    }
+
+    // Unretrieved classes have no logit. -inf is never argmax,
+    // and gets 0 probability by softmax.
+    T missing() const noexcept override { return -std::numeric_limits<T>::infinity(); }
+
+    // Logits are not densified with label.
+    Data<T> forward(std::size_t batch_i, std::span<const std::size_t> i,
+		    std::span<const T> v) override {
+      if(has_label[batch_i]){ return Data<T>{0}; }
+      return OutputLayer<T>::forward(batch_i, i, v);
+    }
+
+    // Loss of batch_i over the previous layer's active neurons.
+    // dL/dz is written into the previous layer's grad.
+    T loss(std::size_t batch_i){
+      const auto p = this->prev_layer();
+      const auto& id = p->active_id(batch_i);
+      const auto z = p->active_value(batch_i);
+      if(!p->has_grad()){ return loss_func.forward(id, z, label[batch_i]); }
+
+      auto& dz = p->grad(batch_i);
+      dz.assign(id.size(), T{0});
+      return loss_func.backward(id, z, label[batch_i], std::to_address(dz.begin()));
+    }
+
+    void reset(std::size_t batch_size) override {
+      OutputLayer<T>::reset(batch_size);
+      if(label.size() < batch_size){ label.resize(batch_size); }
+      has_label.assign(batch_size, 0);
+    }
+  };
+
+
+  // F: activation class. Final class (e.g. ReLU<T>) is called without virtual
+  // dispatch, so that affine and activation are inlined into one loop.
+  template<typename T, typename F = Activation<T>> class DenseLayer : public Layer<T> {
   private:
     std::size_t units;
-    std::vector<Neuron<T>> neuron;
+    ParamStore<T> param;
     std::vector<idx_t> active_idx;
+    std::vector<std::vector<T>> active_val; // Activation aligned with active_idx
     LSH<T> hash;
     std::shared_ptr<Activation<T>> activation;
+    NetworkOption option;
+    IndexSet touched_row;
+    IndexSet touched_col;
+    IndexSet dirty; // rows updated since the last rehash
   public:
     DenseLayer() = delete;
     DenseLayer(std::size_t prev_units, std::size_t units,
@@ -292,15 +1071,19 @@ namespace HashDL {
 	       const std::shared_ptr<Optimizer<T>>& optimizer,
 	       std::shared_ptr<Initializer<T>> weight_initializer = std::shared_ptr<Initializer<T>>{new ConstantInitializer<T>{0}},
 	       T L1=0, T L2=0,
-	       T sparsity = 0.5)
-      : units{units}, neuron{}, active_idx{},
-	hash{L, prev_units, hash_factory, sparsity}, activation{f}
+	       T sparsity = 0.5,
+	       const NetworkOption& option = {})
+      : units{units},
+	param{units, prev_units, optimizer, weight_initializer, L1, L2, option.gradient},
+	active_idx{}, active_val{}, hash{L, prev_units, hash_factory, sparsity, option.table,
+	     option.retrieval, option.min_votes, option.probes},
+	activation{f},
+	option{option}, touched_row{units}, touched_col{prev_units}, dirty{units}
     {
-      neuron.reserve(units);
-      std::generate_n(std::back_inserter(neuron), units,
-		      [&](){ return Neuron<T>{prev_units, optimizer, weight_initializer, L1, L2}; });
-
-      hash.add(neuron);
+      if(!dynamic_cast<const F*>(activation.get())){
+	throw std::runtime_error("Activation mismatch");
+      }
+      hash.add(param);
     }
     DenseLayer(const DenseLayer&) = default;
     DenseLayer(DenseLayer&&) = default;
@@ -308,62 +1091,375 @@ namespace HashDL {
     DenseLayer& operator=(DenseLayer&&) = default;
     ~DenseLayer() = default;
 
+    auto neuron(std::size_t n){ return Neuron<T>{param, n}; }
+    const F* act() const noexcept { return static_cast<const F*>(activation.get()); }
+
     void rehash(){
-      hash.reset();
-      hash.add(neuron);
+      if(!option.incremental_rehash){
+	hash.reset();
+	hash.add(param);
+      } else if(option.sparse_update || param.is_hogwild()){
+	hash.update(param, dirty.indices());
+	dirty.clear();
+      } else {
+	// Dense update moves all neurons.
+	hash.update(param);
+      }
+    }
+
+    // Add neurons required by the next layer to active_idx
+    void require(std::size_t batch_i){
+      const auto n = this->next_layer();
+      if(!n){ return; }
+
+      auto& active = active_idx[batch_i];
+      for(auto r : n->required_id(batch_i)){
+	if(std::find(active.begin(), active.end(), r) == active.end()){
+	  active.push_back(r);
+	}
+      }
+    }
+
+    void compute(std::size_t batch_i, const Data<T>& X, const idx_t& prev_active){
+      const auto& active = active_idx[batch_i];
+      auto& y = active_val[batch_i];
+      hash.retrieve(X, active_idx[batch_i]);
+      require(batch_i);
+
+      y.resize(active.size());
+      for(std::size_t j=0; j<active.size(); ++j){
+	y[j] = neuron(active[j]).forward(X, prev_active, act());
+      }
+    }
+
+    void compute(std::size_t batch_i, std::span<const std::size_t> idx,
+		 std::span<const T> value){
+      const auto& active = active_idx[batch_i];
+      auto& y = active_val[batch_i];
+      hash.retrieve(idx, value, active_idx[batch_i]);
+      require(batch_i);
+
+      y.resize(active.size());
+      for(std::size_t j=0; j<active.size(); ++j){
+	y[j] = neuron(active[j]).forward(idx, value, act());
+      }
     }
 
     Data<T> forward(std::size_t batch_i, const Data<T>& X) override {
-      active_idx[batch_i] = hash.retrieve(X);
+      compute(batch_i, X, this->prev()->active_id(batch_i));
+      return this->next()->forward(batch_i, active_idx[batch_i], active_val[batch_i]);
+    }
+
+    Data<T> forward(std::size_t batch_i, std::span<const std::size_t> idx,
+		    std::span<const T> value) override {
+      compute(batch_i, idx, value);
+      return this->next()->forward(batch_i, active_idx[batch_i], active_val[batch_i]);
+    }
+
+    void forward(std::size_t batch_i) override {
+      const auto p = this->prev_layer();
+      if(p->sparse(batch_i)){
+	compute(batch_i, p->active_id(batch_i), p->active_value(batch_i));
+      } else {
+	compute(batch_i, p->fx(batch_i), p->active_id(batch_i));
+      }
+    }
 
-      for(auto n : active_idx[batch_i]){
-	this->Y[batch_i][n] = neuron[n].forward(X, this->prev()->active_id(batch_i),
-						activation);
+    // Accumulate gradients of active neurons with dL_dy aligned with active_idx,
+    // and propagate to dL_dx (aligned with prev_active) if not null.
+    void accumulate(std::size_t batch_i, const Data<T>& dL_dy, const Layer<T>& prev,
+		    Data<T>* dL_dx){
+      const auto& prev_active = prev.active_id(batch_i);
+      const auto& active = active_idx[batch_i];
+      const auto& y = active_val[batch_i];
+      const auto size = active.size();
+
+      if(prev.sparse(batch_i)){
+	const auto value = prev.active_value(batch_i);
+	if(dL_dx){
+	  const auto dx = std::to_address(dL_dx->begin());
+	  for(std::size_t j=0; j<size; ++j){
+	    neuron(active[j]).backward(prev_active, value, y[j], dL_dy[j], dx, act());
+	  }
+	} else {
+	  for(std::size_t j=0; j<size; ++j){
+	    neuron(active[j]).backward(prev_active, value, y[j], dL_dy[j], act());
+	  }
+	}
+      } else {
+	const auto& X = prev.fx(batch_i);
+	if(dL_dx){
+	  const auto dx = std::to_address(dL_dx->begin());
+	  for(std::size_t j=0; j<size; ++j){
+	    neuron(active[j]).backward(X, y[j], dL_dy[j], prev_active, dx, act());
+	  }
+	} else {
+	  for(std::size_t j=0; j<size; ++j){
+	    neuron(active[j]).backward(X, y[j], dL_dy[j], prev_active, act());
+	  }
+	}
       }
 
-      return this->next()->forward(batch_i, this->Y[batch_i]);
+      if(option.incremental_rehash){
+	for(auto n : active_idx[batch_i]){ dirty.insert(n); }
+      }
+      if(option.sparse_update && !param.is_hogwild()){
+	for(auto n : active_idx[batch_i]){ touched_row.insert(n); }
+	if(prev_active.size() == param.cols()){
+	  touched_col.insert_all();
+	} else {
+	  for(auto i : prev_active){ touched_col.insert(i); }
+	}
+      }
     }
 
-    void backward(std::size_t batch_i, const Data<T>& dL_dy) override {
-      const auto& X = this->prev()->fx(batch_i);
+    // Persistent gradient buffer of prev, 0 filled over its active neurons only
+    static Data<T>& clear_grad(Layer<T>& prev, std::size_t batch_i){
+      auto& dL_dx = prev.grad(batch_i);
+      dL_dx.assign(prev.active_id(batch_i).size(), T{0});
+      return dL_dx;
+    }
 
-      Data<T> dL_dx{X.size()};
-      for(auto n : active_idx[batch_i]){
-	this->neuron[n].backward(X, this->Y[batch_i][n], dL_dy[n], dL_dx,
-				 this->prev()->active_id(batch_i), activation);
+    void backward(std::size_t batch_i, const Data<T>& dL_dy) override {
+      const auto prev = this->prev();
+      if(!prev->has_grad()){
+	accumulate(batch_i, dL_dy, *prev, nullptr);
+	return prev->backward(batch_i, Data<T>{0});
       }
 
-      this->prev()->backward(batch_i, dL_dx);
+      auto& dL_dx = clear_grad(*prev, batch_i);
+      accumulate(batch_i, dL_dy, *prev, &dL_dx);
+      prev->backward(batch_i, dL_dx);
+    }
+
+    void backward(std::size_t batch_i) override {
+      const auto p = this->prev_layer();
+      accumulate(batch_i, this->dY[batch_i], *p,
+		 p->has_grad() ? &clear_grad(*p, batch_i): nullptr);
     }
 
     void reset(std::size_t batch_size) override {
-      this->Y.clear();
-      this->Y.reserve(batch_size);
-      for(std::size_t n=0; n<batch_size; ++n){
-	this->Y.emplace_back(units);
+      // Activation is sparse (active_idx, active_val), so that nothing is cleared.
+      // Keep capacity of active_idx and active_val for allocation free forward
+      if(active_idx.size() < batch_size){
+	active_idx.resize(batch_size);
+	active_val.resize(batch_size);
       }
 
-      active_idx.clear();
-      active_idx.resize(batch_size);
+      // Gradient buffers are sized at backward, and only grow.
+      if(this->dY.size() < batch_size){ this->dY.resize(batch_size, Data<T>{0}); }
     }
 
     const idx_t& active_id(std::size_t batch_i) const override {
       return active_idx[batch_i];
     }
 
+    bool sparse(std::size_t) const noexcept override { return true; }
+
+    void predict(const T* x, idx_t& active, std::vector<T>& y) const override {
+      hash.retrieve(x, active);
+
+      y.resize(active.size());
+      for(std::size_t j=0; j<active.size(); ++j){
+	const auto n = active[j];
+	y[j] = act()->call(param.bias(n) + kernel::dot(param.weight(n), x, param.cols()));
+      }
+    }
+
+    void predict(std::span<const std::size_t> idx, std::span<const T> value,
+		 idx_t& active, std::vector<T>& y) const override {
+      hash.retrieve(idx, value, active);
+
+      y.resize(active.size());
+      for(std::size_t j=0; j<active.size(); ++j){
+	const auto n = active[j];
+	y[j] = act()->call(param.bias(n) +
+			   kernel::sparse_dot(param.weight(n), idx.data(), value.data(),
+					      idx.size()));
+      }
+    }
+
+    std::span<const T> active_value(std::size_t batch_i) const override {
+      return active_val[batch_i];
+    }
+
     void update(bool is_rehash) override {
-      for(auto& n: neuron){ n.update(); }
+      if(param.is_hogwild()){
+	// Parameters are already updated during backward.
+      } else if(option.sparse_update){
+	param.update(touched_row, touched_col);
+	touched_row.clear();
+	touched_col.clear();
+      } else {
+	param.update();
+      }
       if(is_rehash){ rehash(); }
     }
   };
 
 
+  // DenseLayer specialized for the dynamic type of activation f
+  template<typename T, typename... Args>
+  inline std::shared_ptr<Layer<T>> make_dense_layer(std::size_t prev_units, std::size_t units,
+						    const std::shared_ptr<Activation<T>>& f,
+						    Args&&... args){
+    auto make = [&]<typename F>(){
+      return std::shared_ptr<Layer<T>>{
+	new DenseLayer<T, F>{prev_units, units, f, std::forward<Args>(args)...}
+      };
+    };
+
+    if(dynamic_cast<const ReLU<T>*>(f.get())){ return make.template operator()<ReLU<T>>(); }
+    if(dynamic_cast<const Linear<T>*>(f.get())){ return make.template operator()<Linear<T>>(); }
+    if(dynamic_cast<const Sigmoid<T>*>(f.get())){ return make.template operator()<Sigmoid<T>>(); }
+    return make.template operator()<Activation<T>>();
+  }
+
+
   template<typename T> class Network {
   private:
+    std::size_t input_dim;
     std::size_t output_dim;
     std::vector<std::shared_ptr<Layer<T>>> layer;
     std::shared_ptr<Optimizer<T>> opt;
     std::shared_ptr<Scheduler> update_freq;
+    Execution execution;
+    bool hogwild; // Parameters are updated during backward
+    InputLayer<T>* input;   // Not owning. (layer.front())
+    OutputLayer<T>* output; // Not owning. (layer.back())
+    SampledSoftmaxLayer<T>* softmax; // Not owning. output for Output::SampledSoftmax
+    std::size_t loss_batch; // Batch size of the last loss()
+
+    // Per-thread (active, value) of two adjacent layers for predict
+    struct PredictScratch {
+      std::array<idx_t, 2> active;
+      std::array<std::vector<T>, 2> value;
+    };
+    // Shared by copies, as layers are.
+    std::shared_ptr<PerThread<PredictScratch>> predict_scratch;
+
+    // Read-only feed-forward into Y [batch_size, output_dim].
+    // first(i, active, value) writes sparse output of the first hidden layer
+    // (or input itself without hidden layer) for sample i.
+    template<typename F> void predict(std::size_t batch_size, T* Y, F&& first) const {
+      auto batch_idx = index_vec(batch_size);
+      std::for_each(std::execution::par, batch_idx.begin(), batch_idx.end(),
+		    [&, this](auto i){
+		      auto& [active, value] =
+			this->predict_scratch->local([](){ return PredictScratch{}; });
+		      first(i, active[0], value[0]);
+		      for(std::size_t l=2; l+1<this->layer.size(); ++l){
+			this->layer[l]->predict(active[0], value[0], active[1], value[1]);
+			std::swap(active[0], active[1]);
+			std::swap(value[0], value[1]);
+		      }
+
+		      auto y = Y + i * this->output_dim;
+		      std::fill_n(y, this->output_dim, this->output->missing());
+		      for(std::size_t j=0; j<active[0].size(); ++j){
+			y[active[0][j]] = value[0][j];
+		      }
+		    });
+    }
+
+    // Run f(L, i) for all samples i of each layer L in order.
+    template<typename I, typename F> void layer_wise(I begin, I end,
+						     std::size_t batch_size, F&& f){
+      auto batch_idx = index_vec(batch_size);
+      for(auto it = begin; it != end; ++it){
+	auto L = it->get();
+	std::for_each(std::execution::par, batch_idx.begin(), batch_idx.end(),
+		      [&](auto i){ f(L, i); });
+      }
+    }
+
+    // Input is checked before parallel sections,
+    // since exception cannot leave parallel algorithm.
+    void check(const BatchView<T>& X) const {
+      if(X.get_data_size() != input_dim){ throw std::runtime_error("Input size mismatch"); }
+    }
+    // Indices must be unique in a row, since sparse updates of a row
+    // (e.g. Hogwild optimizer) take each index once.
+    void check(const CSRView<T>& X) const {
+      if(X.get_data_size() != input_dim){ throw std::runtime_error("Input size mismatch"); }
+      std::vector<std::uint8_t> seen(input_dim, 0);
+      for(std::size_t i=0; i<X.get_batch_size(); ++i){
+	const auto idx = X.indices(i);
+	for(auto j : idx){
+	  if(j >= input_dim){ throw std::runtime_error("Input index is out of range"); }
+	  if(seen[j]){ throw std::runtime_error("Input index is duplicated"); }
+	  seen[j] = 1;
+	}
+	for(auto j : idx){ seen[j] = 0; }
+      }
+    }
+
+    // Input of sample i for layer-wise execution
+    void set_input(const BatchView<T>& X, std::size_t i){ input->set(i, X.begin(i), X.end(i)); }
+    void set_input(const CSRView<T>& X, std::size_t i){
+      input->set(i, X.indices(i), X.values(i));
+    }
+
+    // Feed-Forward of sample i through the whole layer chain
+    auto forward_input(const BatchView<T>& X, std::size_t i){
+      return input->forward(i, Data<T>{X.begin(i), X.end(i)});
+    }
+    auto forward_input(const CSRView<T>& X, std::size_t i){
+      // Without densifying input
+      return input->forward(i, X.indices(i), X.values(i));
+    }
+
+    template<typename V> auto forward(const V& X){
+      check(X);
+      const auto batch_size = X.get_batch_size();
+
+      for(auto& L: layer){ L->reset(batch_size); }
+
+      auto batch_idx = index_vec(batch_size);
+
+      if(execution == Execution::LayerWise){
+	std::for_each(std::execution::par, batch_idx.begin(), batch_idx.end(),
+		      [&, this](auto i){ this->set_input(X, i); });
+	return forward_layers(batch_size);
+      }
+
+      // Parallel Feed-Forward over Batch
+      BatchData<T> Y{output_dim, batch_size, 0};
+      std::for_each(std::execution::par, batch_idx.begin(), batch_idx.end(),
+		    [&, this](auto i){
+		      auto d = this->forward_input(X, i);
+		      std::move(d.begin(), d.end(), Y.begin(i));
+		    });
+
+      return Y;
+    }
+
+    // Hogwild updates parameters during backward, so that the optimizer
+    // step is counted before it with the same step count as synchronous update.
+    void begin_backward(){
+      if(hogwild){ opt->step(); }
+    }
+
+    // Optimizer step and parameter update after backward
+    void step(){
+      if(!hogwild){ opt->step(); }
+
+      auto is_rehash = (*update_freq)();
+      std::for_each(std::execution::par, layer.begin(), layer.end(),
+		    [=](auto& L){ L->update(is_rehash); });
+    }
+
+    auto forward_layers(std::size_t batch_size){
+      // Input and output layers are handled by the caller.
+      layer_wise(layer.begin() + 1, layer.end() - 1, batch_size,
+		 [](auto L, auto i){ L->forward(i); });
+
+      BatchData<T> Y{output_dim, batch_size, 0};
+      auto batch_idx = index_vec(batch_size);
+      std::for_each(std::execution::par, batch_idx.begin(), batch_idx.end(),
+		    [&, this](auto i){ this->output->get(i, std::to_address(Y.begin(i))); });
+      return Y;
+    }
   public:
     Network() = delete;
     Network(std::size_t input_size, std::vector<std::size_t> units, std::size_t L,
@@ -371,27 +1467,50 @@ namespace HashDL {
 	    std::shared_ptr<Scheduler> update_freq,
 	    std::shared_ptr<Activation<T>> act = std::shared_ptr<Activation<T>>{},
 	    std::shared_ptr<Initializer<T>> init = std::shared_ptr<Initializer<T>>{},
-	    T L1=0, T L2=0, T sparsity = 0.5)
-      : output_dim{units.size() > 0 ? units.back(): input_size}, layer{},
-	opt{opt}, update_freq{update_freq}
+	    T L1=0, T L2=0, T sparsity = 0.5,
+	    const NetworkOption& option = {},
+	    std::shared_ptr<HashFunc<T>> input_hash = std::shared_ptr<HashFunc<T>>{})
+      : input_dim{input_size},
+	output_dim{units.size() > 0 ? units.back(): input_size}, layer{},
+	opt{opt}, update_freq{update_freq}, execution{option.execution},
+	hogwild{option.gradient == GradientMode::Hogwild},
+	input{nullptr}, output{nullptr}, softmax{nullptr}, loss_batch{0},
+	predict_scratch{new PerThread<PredictScratch>{}}
     {
+      const bool sampled = (option.output == Output::SampledSoftmax);
+      if(sampled && units.empty()){
+	throw std::runtime_error("Sampled softmax requires hidden layer");
+      }
       layer.reserve(units.size() + 2);
 
       if(!act){ act.reset(new ReLU<T>{}); }
       if(!init){ init.reset(new ConstantInitializer<T>{0}); }
 
-      layer.emplace_back(new InputLayer<T>{input_size});
+      input = new InputLayer<T>{input_size};
+      layer.emplace_back(input);
       auto prev_units = input_size;
+      // The first hidden layer can use a hash for (sparse) input.
+      if(!input_hash){ input_hash = hash; }
+      const auto logit = std::shared_ptr<Activation<T>>{new Linear<T>{}};
       for(auto& u : units){
-	layer.emplace_back(new DenseLayer<T>{prev_units, u, act, L, hash,
-					     this->opt, init,
-					     L1, L2, sparsity});
+	const auto& h = (layer.size() == 1) ? input_hash: hash;
+	// Logits must not be activated for softmax.
+	const auto& f = (sampled && layer.size() == units.size()) ? logit: act;
+	layer.push_back(make_dense_layer<T>(prev_units, u, f, L, h,
+					    this->opt, init,
+					    L1, L2, sparsity, option));
 	prev_units = u;
 	auto last = layer.size() -1;
 	layer[last]->set_prev(layer[last-1]);
 	layer[last-1]->set_next(layer[last]);
       }
-      layer.emplace_back(new OutputLayer<T>{prev_units});
+      if(sampled){
+	softmax = new SampledSoftmaxLayer<T>{prev_units};
+	output = softmax;
+      } else {
+	output = new OutputLayer<T>{prev_units};
+      }
+      layer.emplace_back(output);
       auto last = layer.size() - 1;
       layer[last]->set_prev(layer[last-1]);
       layer[last-1]->set_next(layer[last]);
@@ -402,41 +1521,161 @@ namespace HashDL {
     Network& operator=(Network&&) = default;
     ~Network() = default;
 
-    auto operator()(const BatchView<T>& X){
+    auto operator()(const BatchView<T>& X){ return forward(X); }
+    auto operator()(const CSRView<T>& X){ return forward(X); }
+
+    std::size_t input_size() const noexcept { return input_dim; }
+    std::size_t output_size() const noexcept { return output_dim; }
+
+    // Inference without training state into Y [batch_size, output_size()].
+    // Outputs not computed by the sparse last hidden layer are 0,
+    // or -inf logits for sampled softmax.
+    // Safe to call concurrently, but not concurrently with training.
+    void predict(const BatchView<T>& X, T* Y) const {
+      check(X);
+      const auto hidden = (layer.size() > 2) ? layer[1].get() : nullptr;
+      predict(X.get_batch_size(), Y, [&](auto i, auto& active, auto& value){
+	if(hidden){ return hidden->predict(X.begin(i), active, value); }
+
+	active = index_vec(X.get_data_size());
+	value.assign(X.begin(i), X.end(i));
+      });
+    }
+
+    void predict(const CSRView<T>& X, T* Y) const {
+      check(X);
+      const auto hidden = (layer.size() > 2) ? layer[1].get() : nullptr;
+      predict(X.get_batch_size(), Y, [&](auto i, auto& active, auto& value){
+	if(hidden){ return hidden->predict(X.indices(i), X.values(i), active, value); }
+
+	active.assign(X.indices(i).begin(), X.indices(i).end());
+	value.assign(X.values(i).begin(), X.values(i).end());
+      });
+    }
+
+    template<typename V> auto predict(const V& X) const {
+      BatchData<T> Y{output_dim, X.get_batch_size(), 0};
+      predict(X, std::to_address(Y.begin()));
+      return Y;
+    }
+
+    auto backward(const BatchView<T>& dL_dy){
+      const auto batch_size = dL_dy.get_batch_size();
+      begin_backward();
+
+      auto batch_idx = index_vec(batch_size);
+      if(execution == Execution::LayerWise){
+	std::for_each(std::execution::par, batch_idx.begin(), batch_idx.end(),
+		      [&, this](auto i){ this->output->set_grad(i, dL_dy.begin(i)); });
+	// Input layer doesn't need gradient.
+	layer_wise(layer.rbegin() + 1, layer.rend() - 1, batch_size,
+		   [](auto L, auto i){ L->backward(i); });
+      } else {
+	std::for_each(std::execution::par, batch_idx.begin(), batch_idx.end(),
+		      [&, this](auto i){
+			auto d = Data<T>{dL_dy.begin(i), dL_dy.end(i)};
+			this->layer.back()->backward(i, d);
+		      });
+      }
+
+      step();
+    }
+
+    // Forward with true labels, and mean of sampled softmax cross entropy.
+    // Only retrieved classes and labels are computed. The gradient is kept
+    // for backward().
+    template<typename V> T loss(const V& X, const LabelView& label){
+      if(!softmax){ throw std::runtime_error("Network output is not sampled softmax"); }
+      check(X);
+
       const auto batch_size = X.get_batch_size();
+      if(label.get_batch_size() != batch_size){
+	throw std::runtime_error("Batch size mismatch");
+      }
 
       for(auto& L: layer){ L->reset(batch_size); }
 
+      // Labels are checked here, since exception cannot leave parallel algorithm.
+      for(std::size_t i=0; i<batch_size; ++i){
+	const auto l = label.indices(i);
+	if(std::any_of(l.begin(), l.end(), [this](auto c){ return c >= this->output_dim; })){
+	  throw std::runtime_error("Label is out of range");
+	}
+	softmax->set_label(i, l);
+      }
+
       auto batch_idx = index_vec(batch_size);
+      std::vector<T> sample_loss(batch_size);
+      if(execution == Execution::LayerWise){
+	std::for_each(std::execution::par, batch_idx.begin(), batch_idx.end(),
+		      [&, this](auto i){ this->set_input(X, i); });
+	layer_wise(layer.begin() + 1, layer.end() - 1, batch_size,
+		   [](auto L, auto i){ L->forward(i); });
+	std::for_each(std::execution::par, batch_idx.begin(), batch_idx.end(),
+		      [&, this](auto i){ sample_loss[i] = this->softmax->loss(i); });
+      } else {
+	std::for_each(std::execution::par, batch_idx.begin(), batch_idx.end(),
+		      [&, this](auto i){
+			this->forward_input(X, i);
+			sample_loss[i] = this->softmax->loss(i);
+		      });
+      }
 
-      // Parallel Feed-Forward over Batch
-      BatchData<T> Y{output_dim, batch_size, 0};
-      std::for_each(std::execution::par, batch_idx.begin(), batch_idx.end(),
-		    [&, this](auto i){
-		      auto d = Data<T>{X.begin(i), X.end(i)};
-		      d = layer.front()->forward(i, d);
+      loss_batch = batch_size;
+      if(batch_size == 0){ return T{0}; }
+      return std::reduce(sample_loss.begin(), sample_loss.end(), T{0}) / batch_size;
+    }
 
-		      std::move(d.begin(), d.end(), Y.begin(i));
-		    });
+    // Backward of the gradient kept by the last loss()
+    void backward(){
+      begin_backward();
+      auto batch_idx = index_vec(loss_batch);
+      if(execution == Execution::LayerWise){
+	layer_wise(layer.rbegin() + 1, layer.rend() - 1, loss_batch,
+		   [](auto L, auto i){ L->backward(i); });
+      } else {
+	const auto p = output->prev_layer();
+	std::for_each(std::execution::par, batch_idx.begin(), batch_idx.end(),
+		      [=](auto i){ p->backward(i, p->grad(i)); });
+      }
 
-      return Y;
+      step();
     }
 
-    auto backward(const BatchView<T>& dL_dy){
-      const auto batch_size = dL_dy.get_batch_size();
+    // Forward, sampled softmax cross entropy, backward and update at once.
+    // Returns mean loss over batch.
+    template<typename V> T train_step(const V& X, const LabelView& label){
+      const auto L = loss(X, label);
+      backward();
+      return L;
+    }
+
+    // Forward, softmax cross entropy against target probability
+    // [batch_size, output_size()], backward and update at once.
+    // Returns mean loss over batch.
+    template<typename V> T train_step(const V& X, const BatchView<T>& target){
+      const auto batch_size = X.get_batch_size();
+      if((target.get_batch_size() != batch_size) ||
+	 (target.get_data_size() != output_dim)){
+	throw std::runtime_error("Target shape mismatch");
+      }
 
+      // Output is overwritten by its gradient.
+      auto Y = forward(X);
+      std::vector<T> sample_loss(batch_size);
+      const auto f = SoftmaxCrossEntropy<T>{};
       auto batch_idx = index_vec(batch_size);
       std::for_each(std::execution::par, batch_idx.begin(), batch_idx.end(),
 		    [&, this](auto i){
-		      auto d = Data<T>{dL_dy.begin(i), dL_dy.end(i)};
-		      this->layer.back()->backward(i, d);
+		      const auto y = std::to_address(Y.begin(i));
+		      sample_loss[i] = f.backward({y, this->output_dim},
+						  {target.begin(i), this->output_dim}, y);
 		    });
 
-      opt->step();
+      backward(BatchView<T>{output_dim, batch_size, std::to_address(Y.begin())});
 
-      auto is_rehash = (*update_freq)();
-      std::for_each(std::execution::par, layer.begin(), layer.end(),
-		    [=](auto& L){ L->update(is_rehash); });
+      if(batch_size == 0){ return T{0}; }
+      return std::reduce(sample_loss.begin(), sample_loss.end(), T{0}) / batch_size;
     }
   };
 
@@ -12,18 +12,39 @@ cdef extern from "slide.hh" namespace "HashDL":
         BatchView(size_t, size_t, T*) except +
         size_t get_batch_size()
         size_t get_data_size()
+    cdef cppclass CSRView[T]:
+        CSRView(size_t, size_t, const size_t*, const size_t*, const T*) except +
+        size_t get_batch_size()
+        size_t get_data_size()
+    cdef cppclass LabelView:
+        LabelView(size_t, const size_t*, const size_t*) except +
+        size_t get_batch_size()
     cdef cppclass HashFunc[T]:
         HashFunc() except +
     cdef cppclass WTAFunc[T]:
         WTAFunc(size_t, size_t) except +
     cdef cppclass DWTAFunc[T]:
         DWTAFunc(size_t, size_t, size_t) except +
+    cdef cppclass SRPFunc[T]:
+        SRPFunc(size_t, size_t) except +
+    cdef cppclass DOPHFunc[T]:
+        DOPHFunc(size_t, size_t, size_t, size_t) except +
+    cdef enum Overflow "HashDL::Overflow":
+        OverflowFIFO "HashDL::Overflow::FIFO"
+        OverflowReservoir "HashDL::Overflow::Reservoir"
+    cdef cppclass TableFunc:
+        TableFunc() except +
+    cdef cppclass MapTableFunc:
+        MapTableFunc() except +
+    cdef cppclass BucketArrayFunc:
+        BucketArrayFunc(size_t, size_t, Overflow) except +
     cdef cppclass Optimizer[T]:
         Optimizer() except +
     cdef cppclass SGD[T]:
         SGD(T, T) except +
     cdef cppclass Adam[T]:
         Adam(T) except +
+        Adam(T, T, T, T, bint) except +
     cdef cppclass Scheduler:
         Scheduler() except +
     cdef cppclass ConstantFrequency:
@@ -48,6 +69,31 @@ cdef extern from "slide.hh" namespace "HashDL":
         ConstantInitializer(size_t) except +
     cdef cppclass GaussInitializer[T]:
         GaussInitializer(T,T) except +
+    cdef enum GradientMode "HashDL::GradientMode":
+        GradientAtomic "HashDL::GradientMode::Atomic"
+        GradientPerThread "HashDL::GradientMode::PerThread"
+        GradientHogwild "HashDL::GradientMode::Hogwild"
+    cdef enum Retrieval "HashDL::Retrieval":
+        RetrievalUnion "HashDL::Retrieval::Union"
+        RetrievalTopK "HashDL::Retrieval::TopK"
+        RetrievalThreshold "HashDL::Retrieval::Threshold"
+    cdef enum Execution "HashDL::Execution":
+        ExecutionSample "HashDL::Execution::Sample"
+        ExecutionLayerWise "HashDL::Execution::LayerWise"
+    cdef enum Output "HashDL::Output":
+        OutputIdentity "HashDL::Output::Identity"
+        OutputSampledSoftmax "HashDL::Output::SampledSoftmax"
+    cdef cppclass NetworkOption:
+        NetworkOption() except +
+        bint sparse_update
+        GradientMode gradient
+        shared_ptr[TableFunc] table
+        bint incremental_rehash
+        Retrieval retrieval
+        size_t min_votes
+        size_t probes
+        Execution execution
+        Output output
     cdef cppclass Network[T]:
         Network(size_t, vector[size_t], size_t, shared_ptr[HashFunc[T]],
                 shared_ptr[Optimizer[T]], shared_ptr[Scheduler]) except +
@@ -63,5 +109,25 @@ cdef extern from "slide.hh" namespace "HashDL":
         Network(size_t, vector[size_t], size_t, shared_ptr[HashFunc[T]],
                 shared_ptr[Optimizer[T]], shared_ptr[Scheduler],
                 shared_ptr[Activation[T]], shared_ptr[Initializer[T]],T,T,T) except +
+        Network(size_t, vector[size_t], size_t, shared_ptr[HashFunc[T]],
+                shared_ptr[Optimizer[T]], shared_ptr[Scheduler],
+                shared_ptr[Activation[T]], shared_ptr[Initializer[T]],T,T,T,
+                const NetworkOption&) except +
+        Network(size_t, vector[size_t], size_t, shared_ptr[HashFunc[T]],
+                shared_ptr[Optimizer[T]], shared_ptr[Scheduler],
+                shared_ptr[Activation[T]], shared_ptr[Initializer[T]],T,T,T,
+                const NetworkOption&, shared_ptr[HashFunc[T]]) except +
         BatchData[T] operator()(const BatchView[T]&) except +
+        BatchData[T] operator()(const CSRView[T]&) except +
         void backward(const BatchView[T]&) except +
+        T loss(const BatchView[T]&, const LabelView&) except + nogil
+        T loss(const CSRView[T]&, const LabelView&) except + nogil
+        void backward() except + nogil
+        T train_step(const BatchView[T]&, const LabelView&) except + nogil
+        T train_step(const CSRView[T]&, const LabelView&) except + nogil
+        T train_step(const BatchView[T]&, const BatchView[T]&) except + nogil
+        T train_step(const CSRView[T]&, const BatchView[T]&) except + nogil
+        void predict(const BatchView[T]&, T*) except + nogil
+        void predict(const CSRView[T]&, T*) except + nogil
+        size_t input_size()
+        size_t output_size()
@@ -0,0 +1,298 @@
+#ifndef TABLE_HH
+#define TABLE_HH
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "data.hh"
+
+namespace HashDL {
+  // Neuron ID stored in tables. 32bit halves bucket memory and bandwidth.
+  using neuron_t = std::uint32_t;
+
+  // Single LSH table from hash code to neuron IDs.
+  // A table is modified by a single thread at once.
+  class HashTable {
+  public:
+    HashTable() = default;
+    HashTable(const HashTable&) = default;
+    HashTable(HashTable&&) = default;
+    HashTable& operator=(const HashTable&) = default;
+    HashTable& operator=(HashTable&&) = default;
+    virtual ~HashTable() = default;
+
+    virtual void insert(hashcode_t code, neuron_t n) = 0;
+    virtual void erase(hashcode_t code, neuron_t n) = 0;
+
+    // Neuron IDs which might have the code.
+    // The span is invalidated by the next modification.
+    virtual std::span<const neuron_t> find(hashcode_t code) const = 0;
+
+    virtual void clear() = 0;
+    virtual std::size_t size() const = 0;
+  };
+
+
+  // Unbounded table keeping all neurons of every code
+  class MapTable : public HashTable {
+  private:
+    std::unordered_map<hashcode_t, std::vector<neuron_t>> backet;
+    std::size_t _size;
+  public:
+    MapTable(): backet{}, _size{0} {}
+    MapTable(const MapTable&) = default;
+    MapTable(MapTable&&) = default;
+    MapTable& operator=(const MapTable&) = default;
+    MapTable& operator=(MapTable&&) = default;
+    ~MapTable() = default;
+
+    void insert(hashcode_t code, neuron_t n) override {
+      backet[code].push_back(n);
+      ++_size;
+    }
+
+    void erase(hashcode_t code, neuron_t n) override {
+      auto it = backet.find(code);
+      if(it == backet.end()){ return; }
+
+      auto& b = it->second;
+      if(auto i = std::find(b.begin(), b.end(), n); i != b.end()){
+	*i = b.back();
+	b.pop_back();
+	--_size;
+      }
+    }
+
+    std::span<const neuron_t> find(hashcode_t code) const override {
+      auto it = backet.find(code);
+      if(it == backet.end()){ return {}; }
+      return it->second;
+    }
+
+    void clear() override {
+      // Codes change at rehash, so that old keys must not be kept.
+      backet.clear();
+      _size = 0;
+    }
+
+    std::size_t size() const override { return _size; }
+  };
+
+
+  enum class Overflow { FIFO, Reservoir };
+
+  // Power of 2 buckets indexed by lower bits of hash code.
+  // Each bucket has fixed capacity and is stored contiguously.
+  // Different codes with the same lower bits share a bucket (as SLIDE).
+  class BucketArray : public HashTable {
+  private:
+    std::size_t mask;
+    std::size_t capacity;
+    Overflow policy;
+    std::vector<neuron_t> data;       // [buckets, capacity]
+    std::vector<std::uint32_t> count; // stored neurons
+    std::vector<std::uintmax_t> seen; // inserted neurons (for reservoir)
+    std::size_t _size;
+    std::mt19937 g;
+
+    neuron_t* bucket(hashcode_t code) noexcept {
+      return data.data() + (code & mask) * capacity;
+    }
+    const neuron_t* bucket(hashcode_t code) const noexcept {
+      return data.data() + (code & mask) * capacity;
+    }
+  public:
+    BucketArray(): BucketArray{10, 128} {}
+    BucketArray(std::size_t bits, std::size_t capacity,
+		Overflow policy = Overflow::FIFO)
+      : mask{(bits < 32) ? (std::size_t{1} << bits) - 1 : 0},
+	capacity{capacity},
+	policy{policy},
+	data((mask + 1) * capacity),
+	count(mask + 1, 0),
+	seen(mask + 1, 0),
+	_size{0},
+	g{std::random_device{}()}
+    {
+      if(bits >= 32){ throw std::runtime_error("bits is too large"); }
+      if(capacity == 0){ throw std::runtime_error("capacity must be positive"); }
+    }
+    BucketArray(const BucketArray&) = default;
+    BucketArray(BucketArray&&) = default;
+    BucketArray& operator=(const BucketArray&) = default;
+    BucketArray& operator=(BucketArray&&) = default;
+    ~BucketArray() = default;
+
+    void insert(hashcode_t code, neuron_t n) override {
+      const auto b = code & mask;
+      auto p = bucket(code);
+      auto& c = count[b];
+      const auto k = seen[b]++;
+
+      if(c < capacity){
+	p[c++] = n;
+	++_size;
+	return;
+      }
+
+      switch(policy){
+      case Overflow::FIFO:
+	// Drop the oldest
+	std::move(p + 1, p + capacity, p);
+	p[capacity - 1] = n;
+	break;
+      case Overflow::Reservoir:
+	// Keep each of (k+1) inserted neurons with probability capacity/(k+1)
+	if(auto r = std::uniform_int_distribution<std::uintmax_t>{0, k}(g); r < capacity){
+	  p[r] = n;
+	}
+	break;
+      }
+    }
+
+    void erase(hashcode_t code, neuron_t n) override {
+      const auto b = code & mask;
+      auto p = bucket(code);
+      auto& c = count[b];
+
+      if(auto i = std::find(p, p + c, n); i != p + c){
+	// Keep insertion order for FIFO
+	std::move(i + 1, p + c, i);
+	--c;
+	--_size;
+	// Erased neuron is no longer a candidate of reservoir.
+	--seen[b];
+      }
+    }
+
+    std::span<const neuron_t> find(hashcode_t code) const override {
+      return {bucket(code), count[code & mask]};
+    }
+
+    void clear() override {
+      std::fill(count.begin(), count.end(), 0);
+      std::fill(seen.begin(), seen.end(), 0);
+      _size = 0;
+    }
+
+    std::size_t size() const override { return _size; }
+  };
+
+
+  // Dense vote counter over neuron IDs.
+  // Counts are reset lazily by epoch stamp, so that begin() is O(1).
+  class VoteCounter {
+  private:
+    std::vector<std::uint32_t> stamp;
+    std::vector<std::uint32_t> vote;
+    std::vector<std::size_t> _candidates;
+    std::uint32_t epoch;
+  public:
+    VoteCounter(): VoteCounter{0} {}
+    VoteCounter(std::size_t N): stamp(N, 0), vote(N, 0), _candidates{}, epoch{0} {
+      _candidates.reserve(N);
+    }
+    VoteCounter(const VoteCounter&) = default;
+    VoteCounter(VoteCounter&&) = default;
+    VoteCounter& operator=(const VoteCounter&) = default;
+    VoteCounter& operator=(VoteCounter&&) = default;
+    ~VoteCounter() = default;
+
+    std::size_t capacity() const noexcept { return stamp.size(); }
+    void resize(std::size_t N){
+      stamp.resize(N, 0);
+      vote.resize(N, 0);
+      _candidates.reserve(N);
+    }
+
+    // Start new counting
+    void begin() noexcept {
+      if(++epoch == 0){
+	std::fill(stamp.begin(), stamp.end(), 0);
+	epoch = 1;
+      }
+      _candidates.clear();
+    }
+
+    // Vote for n and return its votes
+    std::uint32_t add(std::size_t n) noexcept {
+      if(stamp[n] != epoch){
+	stamp[n] = epoch;
+	vote[n] = 0;
+	_candidates.push_back(n); // Never reallocate since reserved.
+      }
+      return ++vote[n];
+    }
+
+    bool contains(std::size_t n) const noexcept { return stamp[n] == epoch; }
+    std::uint32_t votes(std::size_t n) const noexcept { return contains(n) ? vote[n]: 0; }
+
+    // Voted neurons in voted order
+    std::span<std::size_t> candidates() noexcept { return _candidates; }
+    std::size_t size() const noexcept { return _candidates.size(); }
+
+    // Reorder candidates and return k of the most voted
+    // in descending order (ties by smaller ID).
+    std::span<std::size_t> top(std::size_t k){
+      auto c = candidates();
+      k = std::min(k, c.size());
+
+      std::partial_sort(c.begin(), c.begin() + k, c.end(),
+		       [this](auto a, auto b){
+			 const auto va = vote[a], vb = vote[b];
+			 return (va > vb) || ((va == vb) && (a < b));
+		       });
+      return c.first(k);
+    }
+  };
+
+
+  class TableFunc {
+  public:
+    TableFunc() = default;
+    TableFunc(const TableFunc&) = default;
+    TableFunc(TableFunc&&) = default;
+    TableFunc& operator=(const TableFunc&) = default;
+    TableFunc& operator=(TableFunc&&) = default;
+    virtual ~TableFunc() = default;
+
+    virtual HashTable* GetTable() = 0;
+  };
+
+  class MapTableFunc : public TableFunc {
+  public:
+    MapTableFunc() = default;
+    MapTableFunc(const MapTableFunc&) = default;
+    MapTableFunc(MapTableFunc&&) = default;
+    MapTableFunc& operator=(const MapTableFunc&) = default;
+    MapTableFunc& operator=(MapTableFunc&&) = default;
+    ~MapTableFunc() = default;
+
+    HashTable* GetTable() override { return new MapTable{}; }
+  };
+
+  class BucketArrayFunc : public TableFunc {
+  private:
+    std::size_t bits;
+    std::size_t capacity;
+    Overflow policy;
+  public:
+    BucketArrayFunc() = delete;
+    BucketArrayFunc(std::size_t bits, std::size_t capacity,
+		    Overflow policy = Overflow::FIFO)
+      : bits{bits}, capacity{capacity}, policy{policy} {}
+    BucketArrayFunc(const BucketArrayFunc&) = default;
+    BucketArrayFunc(BucketArrayFunc&&) = default;
+    BucketArrayFunc& operator=(const BucketArrayFunc&) = default;
+    BucketArrayFunc& operator=(BucketArrayFunc&&) = default;
+    ~BucketArrayFunc() = default;
+
+    HashTable* GetTable() override { return new BucketArray{bits, capacity, policy}; }
+  };
+}
+#endif
@@ -0,0 +1,177 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <vector>
+
+#include <hash.hh>
+
+// Count heap allocations to show steady state encode is allocation free.
+static std::atomic<std::size_t> allocation{0};
+
+void* operator new(std::size_t size){
+  ++allocation;
+  if(auto p = std::malloc(size)){ return p; }
+  throw std::bad_alloc{};
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+
+namespace {
+  using namespace HashDL;
+
+  // DWTA before flat theta and stack scratch, kept for comparison.
+  template<typename T> class LegacyDWTA : public Hash<T> {
+  private:
+    const std::size_t bin_size;
+    const std::size_t data_size;
+    const std::size_t sample_size;
+    std::size_t sample_bits;
+    const std::size_t max_attempt;
+    std::size_t attempt_bits;
+    std::vector<std::vector<std::size_t>> theta; // [bin_size, sample_size]
+    std::size_t coprime;
+  public:
+    LegacyDWTA(std::size_t bin_size, std::size_t data_size, std::size_t sample_size,
+	       std::size_t max_attempt=100)
+      : bin_size{bin_size},
+	data_size{data_size},
+	sample_size{sample_size},
+	sample_bits{1},
+	max_attempt{max_attempt},
+	attempt_bits{1},
+	theta{},
+	coprime{}
+    {
+      std::size_t power = 2;
+      while(sample_size > power){
+	++sample_bits;
+	power *= 2;
+      }
+
+      power = 2;
+      while(max_attempt > power){
+	++attempt_bits;
+	power *= 2;
+      }
+
+      std::vector<std::size_t> index(data_size);
+      std::iota(index.begin(), index.end(), 0);
+
+      std::mt19937 generator{std::random_device{}()};
+      theta.reserve(bin_size);
+      for(std::size_t i=0; i<bin_size; ++i){
+	std::shuffle(index.begin(), index.end(), generator);
+	theta.emplace_back(index.begin(), index.begin()+sample_size);
+      }
+
+      std::uniform_int_distribution<std::size_t> dist(0, std::numeric_limits<std::size_t>::max());
+      coprime = dist(generator);
+      while(std::gcd(bin_size, coprime) != 1){ coprime = dist(generator); }
+    }
+
+    hashcode_t encode(const Data<T>& data) override {
+      if(data.size() != data_size){ throw std::runtime_error("Data size mismuch!"); }
+
+      std::vector<T> max_vs{};
+      max_vs.reserve(bin_size);
+
+      std::vector<std::size_t> max_is{};
+      max_is.reserve(bin_size);
+
+      for(const auto& th : theta){
+	auto max_v = std::numeric_limits<T>::lowest();
+	std::size_t max_i = 0;
+	for(std::size_t i=0; i<sample_size; ++i){
+	  if(const auto v = data[th[i]]; v > max_v){ max_v = v; max_i = i; }
+	}
+
+	max_vs.push_back(max_v);
+	max_is.push_back(max_i);
+      }
+
+      hashcode_t hash = 0;
+      for(std::size_t i=0; i<bin_size; ++i){
+	if(max_vs[i]){
+	  hash = (hash << sample_bits) | hashcode_t{max_is[i]};
+	}else{
+	  std::size_t next = i;
+	  for(std::size_t attempt=0; attempt<max_attempt; ++attempt){
+	    next = universal_hash(i, attempt);
+	    if(max_vs[next]){ break; }
+	  }
+	  hash = (hash << sample_bits) | hashcode_t{max_is[next]};
+	}
+      }
+
+      return hash;
+    }
+
+    hashcode_t encode(const T*) override { return 0; }
+
+    std::size_t universal_hash(std::size_t i, std::size_t attempt){
+      auto x = (i << attempt_bits) + attempt;
+      return (x * coprime) % bin_size;
+    }
+  };
+
+  template<typename F>
+  void bench(const char* name, std::size_t N, F&& f){
+    hashcode_t sink = 0;
+    const auto alloc = allocation.load();
+    const auto begin = std::chrono::steady_clock::now();
+    for(std::size_t n=0; n<N; ++n){ sink ^= f(n); }
+    const auto end = std::chrono::steady_clock::now();
+
+    std::cout << name << ": "
+	      << std::chrono::duration<double, std::nano>(end - begin).count() / N
+	      << " ns/call, "
+	      << double(allocation.load() - alloc) / N << " allocation/call"
+	      << " (" << sink << ")" << std::endl;
+  }
+}
+
+
+int main(int, char**){
+  const std::size_t bin_size = 8, data_size = 128, sample_size = 8;
+  const std::size_t rows = 1024, N = 1000000;
+
+  std::mt19937 g{std::random_device{}()};
+  std::uniform_real_distribution<float> dist(-1.0, 1.0);
+  std::bernoulli_distribution sparse(0.5);
+
+  std::vector<Data<float>> X{};
+  X.reserve(rows);
+  for(std::size_t n=0; n<rows; ++n){
+    auto& x = X.emplace_back(data_size);
+    for(std::size_t i=0; i<data_size; ++i){ x[i] = sparse(g) ? 0.0f : dist(g); }
+  }
+
+  auto legacy = LegacyDWTA<float>{bin_size, data_size, sample_size};
+  auto dwta = DWTA<float>{bin_size, data_size, sample_size};
+
+  bench("legacy DWTA::encode(Data)", N,
+	[&](auto n){ return legacy.encode(X[n % rows]); });
+  bench("DWTA::encode(Data)", N,
+	[&](auto n){ return dwta.encode(X[n % rows]); });
+
+  std::vector<float> M(rows * data_size);
+  for(std::size_t n=0; n<rows; ++n){
+    std::copy(X[n].begin(), X[n].end(), M.begin() + n * data_size);
+  }
+  bench("DWTA::encode(const T*)", N,
+	[&](auto n){ return dwta.encode(M.data() + (n % rows) * data_size); });
+
+  // One call encodes all rows, so compare with rows times of the above.
+  std::vector<hashcode_t> codes(rows);
+  bench("DWTA::encode(X, rows, stride, codes)", N / rows,
+	[&](auto){
+	  dwta.encode(M.data(), rows, data_size, codes.data());
+	  return codes[0];
+	});
+
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include <data.hh>
+#include <kernel.hh>
+
+namespace {
+  using namespace HashDL;
+
+  // Weight::affine before SIMD kernels, kept for comparison.
+  template<typename T>
+  T legacy_affine(const T* w, T b, const Data<T>& X, const idx_t& prev_active){
+    auto result = b;
+    for(auto i : prev_active){
+      result += w[i]*X[i];
+    }
+    return result;
+  }
+
+  template<typename F>
+  void bench(const char* name, std::size_t N, F&& f){
+    float sink = 0;
+    const auto begin = std::chrono::steady_clock::now();
+    for(std::size_t n=0; n<N; ++n){ sink += f(n); }
+    const auto end = std::chrono::steady_clock::now();
+    std::cout << name << ": "
+	      << std::chrono::duration<double, std::nano>(end - begin).count() / N
+	      << " ns/call (" << sink << ")" << std::endl;
+  }
+}
+
+int main(int, char**){
+  const std::size_t cols = 1024, rows = 256, N = 200000;
+
+  std::mt19937 g{std::random_device{}()};
+  std::uniform_real_distribution<float> dist(-1.0, 1.0);
+
+  auto W = aligned_vector<float>(rows * aligned_stride<float>(cols));
+  for(auto& w : W){ w = dist(g); }
+  auto weight = [&](auto n){ return W.data() + (n % rows) * aligned_stride<float>(cols); };
+
+  auto X = Data<float>{cols};
+  for(auto& x : X){ x = dist(g); }
+  const auto x = std::to_address(X.begin());
+
+  // prev_active of whole previous layer (e.g. InputLayer)
+  const auto all = index_vec(cols);
+  bench("legacy affine (all)", N,
+	[&](auto n){ return legacy_affine(weight(n), 0.0f, X, all); });
+  bench("kernel::dot (all)", N,
+	[&](auto n){ return kernel::dot(weight(n), x, cols); });
+
+  // Randomly selected half of previous layer
+  auto half = index_vec(cols);
+  std::shuffle(half.begin(), half.end(), g);
+  half.resize(cols / 2);
+  bench("legacy affine (half)", N,
+	[&](auto n){ return legacy_affine(weight(n), 0.0f, X, half); });
+  bench("kernel::gather_dot (half)", N,
+	[&](auto n){ return kernel::gather_dot(weight(n), half.data(), x, half.size()); });
+
+  // Sparse values aligned with the same indices
+  auto value = std::vector<float>(half.size());
+  for(auto& v : value){ v = dist(g); }
+  bench("scalar sparse_dot (half)", N,
+	[&](auto n){
+	  return kernel::sparse_dot_scalar(weight(n), half.data(), value.data(), half.size());
+	});
+  bench("kernel::sparse_dot (half)", N,
+	[&](auto n){
+	  return kernel::sparse_dot(weight(n), half.data(), value.data(), half.size());
+	});
+
+  return 0;
+}
@@ -40,10 +40,8 @@ for i in range(epoch):
     for j in range(0, idx.shape[0], batch_size):
         batch_idx = idx[j:j+batch_size]
 
-        y_pred = net(x_train[batch_idx])
-        assert np.isfinite(y_pred).all()
-
-        net.backward(loss.gradient(y_train[batch_idx], y_pred))
+        batch_loss = net.train_step(x_train[batch_idx], y_train[batch_idx], loss=loss)
+        assert np.isfinite(batch_loss)
 
     train_pred = net(x_train)
     train_loss = loss(y_train, train_pred)
@@ -38,6 +38,13 @@ class TestAdam(unittest.TestCase):
         with self.assertRaises(ValueError):
             adam = HashDL.Adam(-10)
 
+    def test_lazy(self):
+        adam = HashDL.Adam(lazy=True)
+        adam = HashDL.Adam(1e-3, lazy=True)
+
+        # Positional arguments after lr don't bind to keyword-only lazy.
+        adam = HashDL.Adam(1e-3, 0.9)
+
 
 class TestWTA(unittest.TestCase):
     def test_WTA(self):
@@ -206,5 +213,367 @@ class TestNetwork(unittest.TestCase):
         Y = net(X)
         net.backward(Y)
 
+    def test_lazy_Adam(self):
+        data_size = 2
+        batch_size = 3
+
+        net = HashDL.Network(data_size, units=(4,), L = 5,
+                             optimizer = HashDL.Adam(lazy=True),
+                             scheduler = HashDL.ConstantFrequency(1),
+                             hash = HashDL.DWTA(8, 1))
+
+        X = np.ones((batch_size, data_size))
+        for _ in range(3):
+            Y = net(X)
+            net.backward(Y)
+
+    def test_per_thread_gradient(self):
+        data_size = 2
+        batch_size = 3
+
+        net = HashDL.Network(data_size, units=(4,), L = 5,
+                             optimizer = HashDL.Adam(),
+                             scheduler = HashDL.ConstantFrequency(1),
+                             hash = HashDL.DWTA(8, 1),
+                             gradient = "per_thread")
+
+        X = np.ones((batch_size, data_size))
+        Y = net(X)
+        net.backward(Y)
+
+    def test_hogwild(self):
+        data_size = 2
+        batch_size = 8
+
+        net = HashDL.Network(data_size, units=(4,), L = 5,
+                             optimizer = HashDL.Adam(lazy=True),
+                             scheduler = HashDL.ConstantFrequency(1),
+                             hash = HashDL.DWTA(8, 1),
+                             gradient = "hogwild")
+
+        X = np.ones((batch_size, data_size))
+        Y = net(X)
+        net.backward(Y)
+
+    def test_invalid_gradient(self):
+        with self.assertRaises(ValueError):
+            net = HashDL.Network(16, gradient = "lock")
+
+    def test_dense_update(self):
+        data_size = 2
+        batch_size = 3
+
+        net = HashDL.Network(data_size, units=(4,), L = 5,
+                             optimizer = HashDL.Adam(),
+                             scheduler = HashDL.ConstantFrequency(1),
+                             hash = HashDL.DWTA(8, 1),
+                             sparse_update = False)
+
+        X = np.ones((batch_size, data_size))
+        Y = net(X)
+        net.backward(Y)
+
+    def test_incremental_rehash(self):
+        data_size = 4
+        batch_size = 3
+
+        net = HashDL.Network(data_size, units=(8,), L = 5,
+                             scheduler = HashDL.ConstantFrequency(1),
+                             hash = HashDL.DWTA(4, 2),
+                             incremental_rehash = True)
+
+        X = np.random.random((batch_size, data_size))
+        for _ in range(3):
+            Y = net(X)
+            net.backward(Y)
+
+    def test_bucket_array(self):
+        data_size = 4
+        batch_size = 3
+
+        for overflow in ["fifo", "reservoir"]:
+            with self.subTest(overflow = overflow):
+                net = HashDL.Network(data_size, units=(8,), L = 5,
+                                     scheduler = HashDL.ConstantFrequency(1),
+                                     hash = HashDL.DWTA(4, 2),
+                                     table = HashDL.BucketArray(2, 4, overflow))
+
+                X = np.random.random((batch_size, data_size))
+                for _ in range(3):
+                    Y = np.array(net(X))
+                    net.backward(Y)
+
+    def test_retrieval(self):
+        data_size = 4
+        batch_size = 3
+
+        for retrieval in ["union", "topk", "threshold"]:
+            with self.subTest(retrieval = retrieval):
+                net = HashDL.Network(data_size, units=(8,), L = 5,
+                                     hash = HashDL.DWTA(4, 2),
+                                     retrieval = retrieval, min_votes = 2)
+
+                X = np.random.random((batch_size, data_size))
+                Y = np.array(net(X))
+                net.backward(Y)
+
+    def test_SRP(self):
+        data_size = 8
+        batch_size = 3
+
+        net = HashDL.Network(data_size, units=(8,), L = 3,
+                             hash = HashDL.SRP(8, 2), probes = 2)
+
+        X = np.random.random((batch_size, data_size))
+        Y = net(X)
+        net.backward(Y)
+
+        with self.assertRaises(ValueError):
+            HashDL.SRP(65)
+
+    def test_DOPH(self):
+        data_size = 64
+        batch_size = 3
+        units = 32
+
+        # Neurons hashed on their largest weights have different MinHash,
+        # so that input retrieves some (not none, not all) of them.
+        net = HashDL.Network(data_size, units=(units,), L_tables = 4,
+                             input_hash = HashDL.DOPH(1, 8, topk=8),
+                             retrieval = "threshold", min_votes = 1,
+                             activation = HashDL.Linear())
+
+        X = np.zeros((batch_size, data_size), dtype=np.float32)
+        for x in X:
+            x[np.random.choice(data_size, data_size // 2, replace=False)] = 1
+        Y = net(X)
+        active = np.count_nonzero(Y, axis=1)
+        self.assertTrue(np.all(active > 0))
+        self.assertTrue(np.all(active < units))
+        net.backward(Y)
+
+        with self.assertRaises(ValueError):
+            HashDL.DOPH(4, 33)
+        with self.assertRaises(ValueError):
+            HashDL.DOPH(4, topk=0)
+
+    def test_multi_probe(self):
+        data_size = 8
+        batch_size = 3
+
+        net = HashDL.Network(data_size, units=(8,), L = 3,
+                             hash = HashDL.DWTA(4, 4), probes = 4)
+
+        X = np.random.random((batch_size, data_size))
+        Y = net(X)
+        net.backward(Y)
+
+        with self.assertRaises(ValueError):
+            HashDL.Network(data_size, probes = 0)
+
+    def test_csr(self):
+        from scipy.sparse import csr_matrix
+
+        data_size = 8
+        batch_size = 3
+
+        for hash in [HashDL.DWTA(4, 4), HashDL.DOPH(4, 4)]:
+            with self.subTest(hash = hash):
+                net = HashDL.Network(data_size, units=(8, 4), L = 3,
+                                     input_hash = hash,
+                                     retrieval = "threshold", min_votes = 1)
+
+                X = np.random.random((batch_size, data_size)).astype(np.single)
+                X[X < 0.5] = 0
+                X[1,:] = 0
+
+                Y = np.array(net(X))
+                np.testing.assert_allclose(net(csr_matrix(X)), Y, rtol=1e-5)
+                net.backward(Y)
+
+        net = HashDL.Network(data_size, units=(8, 4), L_tables = 3)
+        wide = csr_matrix((np.ones(1), ([0], [399999])), shape=(1, 400000))
+        with self.assertRaises(ValueError):
+            net(wide)
+        with self.assertRaises(ValueError):
+            net(np.zeros((1, data_size + 1)))
+        with self.assertRaises(ValueError):
+            net.train_step(wide, np.zeros((1, 4)))
+
+        # Duplicated indices are summed, without modifying the argument.
+        dup = csr_matrix((np.array([0.25, 0.5, 1.0], dtype=np.single),
+                          np.array([2, 2, 5]), np.array([0, 3])), shape=(1, data_size))
+        summed = csr_matrix(dup.toarray())
+        np.testing.assert_allclose(net.predict(dup), net.predict(summed), rtol=1e-5)
+        np.testing.assert_allclose(net(dup), net.predict(summed), rtol=1e-5)
+        self.assertTrue(np.isfinite(net.train_step(dup, np.zeros((1, 4)))))
+        self.assertEqual(dup.nnz, 3)
+
+    def test_execution(self):
+        from scipy.sparse import csr_matrix
+
+        data_size = 8
+        batch_size = 3
+
+        net = HashDL.Network(data_size, units=(8, 4), execution = "layer")
+
+        X = np.random.random((batch_size, data_size)).astype(np.single)
+        X[X < 0.5] = 0
+        for x in [X, csr_matrix(X)]:
+            with self.subTest(x = x):
+                Y = np.array(net(x))
+                self.assertEqual(Y.shape, (batch_size, 4))
+                net.backward(Y)
+
+        with self.assertRaises(ValueError):
+            HashDL.Network(data_size, execution = "batch")
+
+    def test_sampled_softmax(self):
+        from scipy.sparse import csr_matrix
+
+        data_size = 8
+        batch_size = 2
+        n_class = 6
+
+        # Nothing is retrieved, so that only true labels are computed.
+        net = HashDL.Network(data_size, units=(8, n_class), L_tables = 3,
+                             initializer = HashDL.ConstantInitializer(0.5),
+                             retrieval = "threshold", min_votes = 4,
+                             output = "sampled_softmax")
+
+        X = np.random.random((batch_size, data_size)).astype(np.single)
+        X[X < 0.5] = 0
+        y = csr_matrix(np.array([[0, 0, 0, 1, 0, 0],
+                                 [0, 1, 0, 0, 1, 0]], dtype=np.single))
+
+        for x in [X, csr_matrix(X)]:
+            with self.subTest(x = x):
+                self.assertAlmostEqual(net.loss(x, y), np.log(2) / 2, places=5)
+                net.backward()
+                self.assertAlmostEqual(net.loss(x, [3, 1]), 0)
+                net.backward()
+
+        self.assertEqual(np.array(net(X)).shape, (batch_size, n_class))
+
+        with self.assertRaises(ValueError):
+            net.loss(X, [-1, 0])
+
+        with self.assertRaises(RuntimeError):
+            net.loss(X, [n_class, 0])
+
+        with self.assertRaises(ValueError):
+            HashDL.Network(data_size, output = "softmax")
+
+        with self.assertRaises(ValueError):
+            HashDL.Network(data_size, units = [], output = "sampled_softmax")
+
+        with self.assertRaises(RuntimeError):
+            HashDL.Network(data_size).loss(X, [0, 1])
+
+    def test_sampled_softmax_unretrieved(self):
+        data_size = 8
+        batch_size = 2
+        n_class = 6
+
+        X = np.random.random((batch_size, data_size)).astype(np.single) + 0.1
+
+        # Retrieved logits are all negative, so that 0 would be argmax.
+        net = HashDL.Network(data_size, units=(n_class,),
+                             initializer = HashDL.GaussInitializer(-5, 1),
+                             output = "sampled_softmax")
+        Y = net.predict(X)
+        self.assertTrue(np.all(Y < 0))
+        np.testing.assert_array_equal(np.array(net(X)), Y)
+
+        # Nothing is retrieved.
+        net = HashDL.Network(data_size, units=(n_class,), L_tables = 3,
+                             initializer = HashDL.GaussInitializer(-5, 1),
+                             retrieval = "threshold", min_votes = 4,
+                             output = "sampled_softmax")
+        np.testing.assert_array_equal(net.predict(X), -np.inf)
+        np.testing.assert_array_equal(np.array(net(X)), -np.inf)
+
+    def test_train_step(self):
+        from scipy.sparse import csr_matrix
+
+        data_size = 8
+        batch_size = 3
+        n_class = 4
+
+        X = np.random.random((batch_size, data_size)).astype(np.single)
+        X[X < 0.5] = 0
+        y = np.eye(n_class, dtype=np.single)[[0, 3, 1]]
+
+        kwargs = {"units": (8, n_class),
+                  "initializer": HashDL.ConstantInitializer(0.5),
+                  "optimizer": HashDL.SGD(0.1)}
+        fused = HashDL.Network(data_size, **kwargs)
+        manual = HashDL.Network(data_size, **kwargs)
+        softmax = HashDL.SoftmaxCrossEntropy()
+
+        for x in [X, csr_matrix(X)]:
+            with self.subTest(x = x):
+                Y = np.array(manual(x))
+                L = softmax(y, Y)
+                manual.backward(softmax.gradient(y, Y))
+
+                self.assertAlmostEqual(fused.train_step(x, y), L, places=5)
+                np.testing.assert_allclose(fused(x), manual(x), rtol=1e-5)
+
+        self.assertAlmostEqual(fused.train_step(X, y, loss = softmax),
+                               manual.train_step(X, y, loss = "softmax_cross_entropy"),
+                               places=5)
+
+        with self.assertRaises(ValueError):
+            fused.train_step(X, y, loss = "mse")
+
+        with self.assertRaises(RuntimeError):
+            fused.train_step(X, y[:,:2])
+
+        sampled = HashDL.Network(data_size, output = "sampled_softmax", **kwargs)
+        for x in [X, csr_matrix(X)]:
+            with self.subTest(x = x):
+                self.assertTrue(np.isfinite(sampled.train_step(x, [0, 3, 1])))
+                self.assertTrue(np.isfinite(sampled.train_step(x, csr_matrix(y))))
+
+    def test_predict(self):
+        from concurrent.futures import ThreadPoolExecutor
+        from scipy.sparse import csr_matrix
+
+        data_size = 8
+        batch_size = 3
+
+        net = HashDL.Network(data_size, units=(8, 4), L = 3,
+                             retrieval = "threshold", min_votes = 1)
+
+        X = np.random.random((batch_size, data_size)).astype(np.single)
+        X[X < 0.5] = 0
+
+        Y = np.array(net(X))
+        np.testing.assert_allclose(net.predict(X), Y, rtol=1e-5)
+        np.testing.assert_allclose(net.predict(csr_matrix(X)), Y, rtol=1e-5)
+
+        with ThreadPoolExecutor(4) as pool:
+            for P in pool.map(net.predict, [X] * 8):
+                np.testing.assert_allclose(P, Y, rtol=1e-5)
+
+        # Training state is kept.
+        net.backward(Y)
+
+        with self.assertRaises(ValueError):
+            net.predict(np.zeros((1, data_size + 1)))
+        with self.assertRaises(ValueError):
+            net.predict(csr_matrix((1, data_size + 1)))
+
+    def test_invalid_retrieval(self):
+        with self.assertRaises(ValueError):
+            HashDL.Network(16, retrieval = "all")
+        with self.assertRaises(ValueError):
+            HashDL.Network(16, retrieval = "threshold", min_votes = 0)
+
+    def test_invalid_overflow(self):
+        with self.assertRaises(ValueError):
+            HashDL.BucketArray(overflow = "lifo")
+
 if __name__ == "__main__":
     unittest.main()
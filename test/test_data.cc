@@ -1,3 +1,5 @@
+#include <thread>
+
 #include <data.hh>
 
 #include "unittest.hh"
@@ -41,5 +43,109 @@ int main(int, char**){
     AssertEqual(data, v);
   }, "Data vector construction");
 
+  test.Add([=](){
+    auto data = Data<float>{10};
+    const auto p = std::to_address(data.begin());
+    data.assign(v.begin(), v.end());
+
+    AssertEqual(data, v);
+    AssertEqual(data.size(), v.size());
+    AssertEqual(std::to_address(data.begin()), p);
+  }, "Data assign");
+
+  test.Add([](){
+    auto v = aligned_vector<float>(10, 0.5);
+
+    AssertEqual(reinterpret_cast<std::uintptr_t>(v.data()) % 64, 0);
+    AssertEqual(v.size(), 10);
+    AssertEqual(v[9], 0.5);
+  }, "aligned_vector");
+
+  test.Add([](){
+    AssertEqual(aligned_stride<float>(1), 16);
+    AssertEqual(aligned_stride<float>(16), 16);
+    AssertEqual(aligned_stride<float>(17), 32);
+    AssertEqual(aligned_stride<double>(9), 16);
+  }, "aligned_stride");
+
+  test.Add([](){
+    auto set = IndexSet{5};
+
+    AssertEqual(set.size(), 0);
+    AssertEqual(set.capacity(), 5);
+    AssertFalse(set.full());
+
+    set.insert(3);
+    set.insert(1);
+    set.insert(3);
+    AssertEqual(set.size(), 2);
+    AssertTrue(set.contains(1));
+    AssertTrue(set.contains(3));
+    AssertFalse(set.contains(0));
+
+    auto idx = std::vector<std::size_t>(set.indices().begin(), set.indices().end());
+    std::sort(idx.begin(), idx.end());
+    AssertEqual(idx, std::vector<std::size_t>{1, 3});
+
+    set.clear();
+    AssertEqual(set.size(), 0);
+    AssertFalse(set.contains(3));
+
+    set.insert_all();
+    AssertTrue(set.full());
+    AssertTrue(set.contains(0));
+    AssertEqual(set.size(), 5);
+
+    set.clear();
+    AssertFalse(set.full());
+  }, "IndexSet");
+
+  test.Add([](){
+    auto local = PerThread<std::vector<int>>{};
+    auto make = [](){ return std::vector<int>{}; };
+
+    local.local(make).push_back(1);
+    local.local(make).push_back(2);
+    AssertEqual(local.size(), 1);
+    AssertEqual(local.local(make), std::vector<int>{1, 2});
+
+    std::thread{[&](){ local.local(make).push_back(3); }}.join();
+    AssertEqual(local.size(), 2);
+
+    auto sum = 0;
+    local.for_each([&](auto& v){ for(auto vi : v){ sum += vi; } });
+    AssertEqual(sum, 6);
+  }, "PerThread");
+
+  test.Add([](){
+    // [[0, 1.5, 0], [0, 0, 0], [2.0, 0, 3.0]]
+    auto indptr = std::vector<std::size_t>{0, 1, 1, 3};
+    auto indices = std::vector<std::size_t>{1, 0, 2};
+    auto values = std::vector<float>{1.5, 2.0, 3.0};
+    auto X = CSRView<float>{3, 3, indptr.data(), indices.data(), values.data()};
+
+    AssertEqual(X.get_data_size(), 3);
+    AssertEqual(X.get_batch_size(), 3);
+    AssertEqual(X.indices(0).size(), 1);
+    AssertEqual(X.indices(0)[0], 1);
+    AssertEqual(X.values(0)[0], 1.5f);
+    AssertEqual(X.indices(1).size(), 0);
+    AssertEqual(X.indices(2)[1], 2);
+    AssertEqual(X.values(2)[1], 3.0f);
+  }, "CSRView");
+
+  test.Add([](){
+    auto indptr = std::vector<std::size_t>{0, 1, 1, 3};
+    auto indices = std::vector<std::size_t>{4, 0, 2};
+    auto y = LabelView{3, indptr.data(), indices.data()};
+
+    AssertEqual(y.get_batch_size(), 3);
+    AssertEqual(y.indices(0).size(), 1);
+    AssertEqual(y.indices(0)[0], 4);
+    AssertEqual(y.indices(1).size(), 0);
+    AssertEqual(y.indices(2)[0], 0);
+    AssertEqual(y.indices(2)[1], 2);
+  }, "LabelView");
+
   return test.Run();
 }
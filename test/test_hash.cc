@@ -1,3 +1,11 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <vector>
+
 #include <hash.hh>
 
 #include "unittest.hh"
@@ -49,5 +57,328 @@ int main(int, char**){
     }, "Mis much data size");
   }, "DWTA error");
 
+  test.Add([](){
+    std::mt19937 g{42};
+    std::uniform_real_distribution<float> dist(-1.0, 1.0);
+
+    auto sampler = WTASampler<float>{12, 100, 6, g};
+    std::vector<float> x(100);
+    std::generate(x.begin(), x.end(), [&](){ return dist(g); });
+
+    const auto stride = sampler.bin_stride();
+    std::vector<float> v(stride), v_scalar(stride);
+    std::vector<std::int32_t> i(stride), i_scalar(stride);
+    sampler.max(x.data(), v.data(), i.data());
+    sampler.max_scalar(x.data(), v_scalar.data(), i_scalar.data());
+
+    for(std::size_t b=0; b<sampler.bin_size(); ++b){
+      AssertEqual(v[b], v_scalar[b]);
+      AssertEqual(i[b], i_scalar[b]);
+    }
+  }, "WTASampler SIMD == scalar");
+
+  test.Add([](){
+    std::mt19937 g{42};
+    std::uniform_real_distribution<float> dist(-1.0, 1.0);
+    std::bernoulli_distribution sparse(0.5);
+
+    const std::size_t rows = 37, cols = 100, stride = 104;
+    std::vector<float> X(rows * stride);
+    std::generate(X.begin(), X.end(), [&](){ return sparse(g) ? 0.0f : dist(g); });
+
+    for(std::size_t bin_size : {6, 12}){
+      auto sampler = WTASampler<float>{bin_size, cols, 6, g};
+      const auto bs = sampler.bin_stride();
+      std::vector<float> v(rows * bs), v_scalar(bs);
+      std::vector<std::int32_t> i(rows * bs), i_scalar(bs);
+      sampler.max(X.data(), rows, stride, v.data(), i.data());
+
+      for(std::size_t n=0; n<rows; ++n){
+	sampler.max_scalar(X.data() + n * stride, v_scalar.data(), i_scalar.data());
+	for(std::size_t b=0; b<bin_size; ++b){
+	  AssertEqual(v[n * bs + b], v_scalar[b]);
+	  AssertEqual(i[n * bs + b], i_scalar[b]);
+	}
+      }
+    }
+  }, "WTASampler batch == scalar");
+
+  test.Add([](){
+    std::mt19937 g{42};
+    std::uniform_real_distribution<float> dist(-1.0, 1.0);
+
+    const std::size_t rows = 37, cols = 30, stride = 32;
+    std::vector<float> X(rows * stride);
+    std::generate(X.begin(), X.end(), [&](){ return dist(g); });
+
+    auto wta = WTA<float>{6, cols, 8};
+    std::vector<hashcode_t> codes(rows);
+    wta.encode(X.data(), rows, stride, codes.data());
+
+    for(std::size_t n=0; n<rows; ++n){
+      const auto x = X.data() + n * stride;
+      AssertEqual(codes[n], wta.encode(Data<float>{x, x + cols}));
+    }
+  }, "WTA batch encode");
+
+  test.Add([](){
+    std::mt19937 g{42};
+    std::uniform_real_distribution<float> dist(-1.0, 1.0);
+    std::bernoulli_distribution sparse(0.7);
+
+    const std::size_t rows = 37, cols = 30, stride = 32;
+    std::vector<float> X(rows * stride);
+    std::generate(X.begin(), X.end(),
+		  [&](){ return sparse(g) ? 0.0f : dist(g); });
+
+    auto dwta = DWTA<float>{6, cols, 8};
+    std::vector<hashcode_t> codes(rows);
+    dwta.encode(X.data(), rows, stride, codes.data());
+
+    for(std::size_t n=0; n<rows; ++n){
+      const auto x = X.data() + n * stride;
+      AssertEqual(codes[n], dwta.encode(Data<float>{x, x + cols}));
+    }
+  }, "DWTA batch encode");
+
+  test.Add([](){
+    auto dwta = DWTA<float>{8, 16, 4};
+    for(std::size_t i=0; i<8; ++i){
+      for(std::size_t a=0; a<100; ++a){
+	AssertTrue(dwta.universal_hash(i, a) < 8);
+      }
+    }
+  }, "DWTA densification");
+
+  test.Add([](){
+    std::mt19937 g{42};
+    std::uniform_real_distribution<float> dist(-1.0, 1.0);
+
+    const std::size_t bin_size = 6, data_size = 30, sample_size = 8, bits = 3;
+    auto wta = WTA<float>{bin_size, data_size, sample_size};
+
+    std::vector<float> x(data_size);
+    std::generate(x.begin(), x.end(), [&](){ return dist(g); });
+
+    std::vector<hashcode_t> codes(4);
+    AssertEqual(wta.probe(x.data(), 1, codes.data()), std::size_t{1});
+    AssertEqual(codes[0], wta.encode(x.data()));
+
+    const auto m = wta.probe(x.data(), codes.size(), codes.data());
+    AssertEqual(m, codes.size());
+    AssertEqual(codes[0], wta.encode(x.data()));
+
+    // Each neighbour differs at a single bin
+    for(std::size_t j=1; j<m; ++j){
+      std::size_t diff = 0;
+      for(std::size_t b=0; b<bin_size; ++b){
+	const auto mask = ((hashcode_t{1} << bits) - 1) << (b * bits);
+	if((codes[0] & mask) != (codes[j] & mask)){ ++diff; }
+      }
+      AssertEqual(diff, std::size_t{1});
+      for(std::size_t k=0; k<j; ++k){ AssertTrue(codes[k] != codes[j]); }
+    }
+  }, "WTA probe");
+
+  test.Add([](){
+    std::mt19937 g{42};
+    std::uniform_real_distribution<float> dist(-1.0, 1.0);
+    std::bernoulli_distribution sparse(0.5);
+
+    auto dwta = DWTA<float>{6, 30, 8};
+    std::vector<float> x(30);
+    std::generate(x.begin(), x.end(), [&](){ return sparse(g) ? 0.0f : dist(g); });
+
+    std::vector<hashcode_t> codes(8);
+    const auto m = dwta.probe(x.data(), codes.size(), codes.data());
+    AssertTrue(m >= 1);
+    AssertTrue(m <= codes.size());
+    AssertEqual(codes[0], dwta.encode(x.data()));
+
+    // Without runner-up, only the code itself
+    auto one = DWTA<float>{6, 30, 1};
+    AssertEqual(one.probe(x.data(), codes.size(), codes.data()), std::size_t{1});
+    AssertEqual(codes[0], one.encode(x.data()));
+  }, "DWTA probe");
+
+  test.Add([](){
+    auto srp = SRP<float>{};
+    auto d = Data<float>{16};
+
+    AssertEqual(srp.encode(d), srp.encode(d));
+    AssertEqual(srp.encode(d), hashcode_t{0});
+  }, "SRP");
+
+  test.Add([](){
+    using SRP_t = SRP<float>;
+    AssertRaises<std::runtime_error>([](){ SRP_t{65, 16, 4}; }, "bits > 64");
+    AssertRaises<std::runtime_error>([](){ SRP_t{16, 2, 4}; }, "data size < nnz");
+    AssertRaises<std::runtime_error>([=](){
+      auto srp = SRP_t{16, 8, 4};
+      auto d = Data<float>{10};
+      srp.encode(d);
+    }, "Mis mutch data size");
+  }, "SRP error");
+
+  test.Add([](){
+    std::mt19937 g{42};
+    std::uniform_real_distribution<float> dist(-1.0, 1.0);
+
+    const std::size_t rows = 37, cols = 30, stride = 32;
+    std::vector<float> X(rows * stride);
+    std::generate(X.begin(), X.end(), [&](){ return dist(g); });
+
+    auto srp = SRP<float>{64, cols, 3};
+    std::vector<hashcode_t> codes(rows);
+    srp.encode(X.data(), rows, stride, codes.data());
+
+    for(std::size_t n=0; n<rows; ++n){
+      const auto x = X.data() + n * stride;
+      AssertEqual(codes[n], srp.encode(Data<float>{x, x + cols}));
+
+      // Sign of projection is invariant to positive scaling.
+      auto y = std::vector<float>(x, x + cols);
+      for(auto& yi : y){ yi *= 3; }
+      AssertEqual(codes[n], srp.encode(y.data()));
+    }
+  }, "SRP batch encode");
+
+  test.Add([](){
+    std::mt19937 g{42};
+    std::uniform_real_distribution<float> dist(-1.0, 1.0);
+
+    auto srp = SRP<float>{16, 30, 4};
+    std::vector<float> x(30);
+    std::generate(x.begin(), x.end(), [&](){ return dist(g); });
+
+    std::vector<hashcode_t> codes(5);
+    AssertEqual(srp.probe(x.data(), codes.size(), codes.data()), codes.size());
+    AssertEqual(codes[0], srp.encode(x.data()));
+    for(std::size_t j=1; j<codes.size(); ++j){
+      AssertEqual(std::popcount(codes[0] ^ codes[j]), 1);
+    }
+  }, "SRP probe");
+
+  test.Add([](){
+    auto func = SRPFunc<float>{8, 100};
+    auto srp = std::unique_ptr<Hash<float>>{func.GetHash(16)};
+    AssertEqual(srp->encode(Data<float>{16}), hashcode_t{0});
+  }, "SRPFunc");
+
+  test.Add([](){
+    auto doph = DOPH<float>{};
+    auto d = Data<float>{16};
+
+    AssertEqual(doph.encode(d), doph.encode(d));
+    AssertEqual(doph.encode(d), hashcode_t{0});
+    AssertTrue(doph.sparse());
+    AssertFalse(WTA<float>{}.sparse());
+  }, "DOPH");
+
+  test.Add([](){
+    using DOPH_t = DOPH<float>;
+    AssertRaises<std::runtime_error>([](){ DOPH_t{8, 16, 0}; }, "bits == 0");
+    AssertRaises<std::runtime_error>([](){ DOPH_t{8, 16, 33}; }, "bits > 32");
+    AssertRaises<std::runtime_error>([](){ DOPH_t{16, 16, 8}; }, "bin size * bits > 64");
+    AssertRaises<std::runtime_error>([](){ DOPH_t{8, 16, 8, 100, 0}; }, "topk == 0");
+    AssertRaises<std::runtime_error>([=](){
+      auto doph = DOPH_t{8, 8, 8};
+      auto d = Data<float>{10};
+      doph.encode(d);
+    }, "Mis mutch data size");
+    AssertRaises<std::runtime_error>([=](){
+      auto wta = WTA<float>{};
+      Hash<float>& h = wta;
+      auto idx = std::vector<std::size_t>{1};
+      auto v = std::vector<float>{1};
+      h.encode(idx, v);
+    }, "WTA doesn't support sparse input");
+  }, "DOPH error");
+
+  test.Add([](){
+    const std::size_t data_size = 1000000;
+    auto doph = DOPH<float>{8, data_size, 8};
+
+    auto idx = std::vector<std::size_t>{3, 17, 4242, 99999, 765432};
+    auto value = std::vector<float>{1, 2, 3, 4, 5};
+    const auto code = doph.encode(idx, value);
+
+    // Independent from order and value
+    auto ridx = std::vector<std::size_t>(idx.rbegin(), idx.rend());
+    AssertEqual(doph.encode(ridx, std::vector<float>(5, 1)), code);
+    AssertEqual(doph.encode(idx, std::span<const float>{}), code);
+
+    // Zero values are not in the set
+    idx.push_back(12345);
+    value.push_back(0);
+    AssertEqual(doph.encode(idx, value), code);
+
+    // Same as dense input
+    auto dense = DOPH<float>{8, 32, 8};
+    auto x = std::vector<float>(32, 0);
+    auto sidx = std::vector<std::size_t>{1, 5, 20, 31};
+    for(auto i : sidx){ x[i] = 1; }
+    AssertEqual(dense.encode(x.data()), dense.encode(sidx, std::span<const float>{}));
+  }, "DOPH sparse encode");
+
+  test.Add([](){
+    std::mt19937 g{42};
+    std::normal_distribution<float> dist(0.0, 1.0);
+
+    const std::size_t rows = 32, data_size = 64, topk = 8;
+    auto doph = DOPH<float>{2, data_size, 8, 100, topk};
+    std::vector<float> W(rows * data_size);
+    std::generate(W.begin(), W.end(), [&](){ return dist(g); });
+
+    std::vector<hashcode_t> codes(rows);
+    doph.encode_weight(W.data(), rows, data_size, codes.data());
+
+    // Dense Gaussian rows are the same full set as input.
+    for(std::size_t n=1; n<rows; ++n){
+      AssertEqual(doph.encode(W.data() + n * data_size), doph.encode(W.data()));
+    }
+
+    auto unique = codes;
+    std::sort(unique.begin(), unique.end());
+    AssertTrue(std::unique(unique.begin(), unique.end()) - unique.begin() > 1);
+
+    for(std::size_t n=0; n<rows; ++n){
+      const auto w = W.data() + n * data_size;
+      AssertEqual(doph.encode_weight(w), codes[n]);
+
+      // Neuron collides with input of its topk support.
+      std::vector<std::size_t> idx(data_size);
+      std::iota(idx.begin(), idx.end(), 0);
+      std::sort(idx.begin(), idx.end(),
+		[w](auto a, auto b){ return std::abs(w[a]) > std::abs(w[b]); });
+      idx.resize(topk);
+      AssertEqual(doph.encode(idx, std::vector<float>{}), codes[n]);
+
+      // Support selected once is shared by every table.
+      AssertEqual(doph.weight_support(), topk);
+      std::vector<std::uint32_t> order;
+      std::vector<std::size_t> support(topk);
+      const auto m = top_support(w, data_size, topk, order, support.data());
+      AssertEqual(m, topk);
+      AssertEqual(doph.encode({support.data(), m}, {}), codes[n]);
+    }
+
+    // Zero weights are not in support.
+    std::vector<float> z(data_size, 0);
+    z[3] = -2; z[7] = 1;
+    std::vector<std::uint32_t> order;
+    std::vector<std::size_t> support(topk);
+    AssertEqual(top_support(z.data(), data_size, topk, order, support.data()), std::size_t{2});
+    AssertEqual(support[0] + support[1], std::size_t{10});
+
+    AssertEqual(DWTA<float>{}.weight_support(), std::size_t{0});
+  }, "DOPH weight");
+
+  test.Add([](){
+    auto func = DOPHFunc<float>{8, 8};
+    auto doph = std::unique_ptr<Hash<float>>{func.GetHash(16)};
+    AssertEqual(doph->encode(Data<float>{16}), hashcode_t{0});
+  }, "DOPHFunc");
+
   return test.Run();
 }
@@ -0,0 +1,83 @@
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <kernel.hh>
+
+#include "unittest.hh"
+
+int main(int, char**){
+  using namespace HashDL;
+
+  auto test = Test{};
+
+  std::mt19937 g{42};
+  std::uniform_real_distribution<float> dist(-1.0, 1.0);
+  const std::size_t d = 100;
+  auto w = std::vector<float>(d);
+  auto x = std::vector<float>(d);
+  for(auto& wi : w){ wi = dist(g); }
+  for(auto& xi : x){ xi = dist(g); }
+
+  // Every index twice, so that SIMD gather has duplicates.
+  auto idx = std::vector<std::size_t>{};
+  for(std::size_t i=0; i<d; i+=3){ idx.push_back(i); idx.push_back(d - 1 - i); }
+
+  // Tolerance for different summation order
+  auto close = [](float a, float b){ AssertTrue(std::abs(a - b) <= 1e-4f); };
+
+  test.Add([=](){
+    for(std::size_t n : {0, 1, 7, 8, 15, 16, 17, 33, 100}){
+      close(kernel::dot(w.data(), x.data(), n),
+	    kernel::dot_scalar(w.data(), x.data(), n));
+    }
+    AssertEqual(kernel::dot_scalar(w.data(), x.data(), 0), 0.0f);
+    AssertEqual(kernel::dot_scalar(w.data(), x.data(), 1), w[0]*x[0]);
+  }, "dot");
+
+  test.Add([=](){
+    for(std::size_t n : {0, 1, 7, 8, 15, 16, 17, 33, 67}){
+      auto expected = 0.0f;
+      for(std::size_t j=0; j<n; ++j){ expected += w[idx[j]] * x[idx[j]]; }
+
+      close(kernel::gather_dot(w.data(), idx.data(), x.data(), n), expected);
+      close(kernel::gather_dot_scalar(w.data(), idx.data(), x.data(), n), expected);
+    }
+  }, "gather_dot");
+
+  test.Add([=](){
+    for(std::size_t n : {0, 1, 7, 8, 15, 16, 17, 33, 67}){
+      auto expected = 0.0f;
+      for(std::size_t j=0; j<n; ++j){ expected += w[idx[j]] * x[j]; }
+
+      close(kernel::sparse_dot(w.data(), idx.data(), x.data(), n), expected);
+      close(kernel::sparse_dot_scalar(w.data(), idx.data(), x.data(), n), expected);
+    }
+  }, "sparse_dot");
+
+  test.Add([=](){
+    for(std::size_t n : {0, 1, 7, 8, 15, 16, 17, 33, 67}){
+      auto expected = std::vector<float>(x.begin(), x.begin() + n);
+      for(std::size_t j=0; j<n; ++j){ expected[j] += 0.5f * w[idx[j]]; }
+
+      auto y = std::vector<float>(x.begin(), x.begin() + n);
+      kernel::gather_axpy(0.5f, w.data(), idx.data(), y.data(), n);
+      for(std::size_t j=0; j<n; ++j){ close(y[j], expected[j]); }
+    }
+  }, "gather_axpy");
+
+  test.Add([](){
+    auto w = std::vector<double>{1.0, 2.0, 3.0};
+    auto x = std::vector<double>{0.5, 0.5, 2.0};
+    auto idx = std::vector<std::size_t>{2, 0};
+
+    AssertEqual(kernel::dot(w.data(), x.data(), 3), 7.5);
+    AssertEqual(kernel::gather_dot(w.data(), idx.data(), x.data(), 2), 6.5);
+    AssertEqual(kernel::sparse_dot(w.data(), idx.data(), x.data(), 2), 2.0);
+
+    kernel::gather_axpy(2.0, w.data(), idx.data(), x.data(), 2);
+    AssertEqual(x, std::vector<double>{6.5, 2.5, 2.0});
+  }, "double (portable)");
+
+  return test.Run();
+}
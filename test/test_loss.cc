@@ -0,0 +1,78 @@
+#include <cmath>
+#include <vector>
+
+#include <loss.hh>
+
+#include "unittest.hh"
+
+using namespace HashDL;
+
+int main(int, char**){
+  auto test = Test{};
+
+  test.Add([](){
+    auto L = SoftmaxCrossEntropy<float>{};
+    auto z = std::vector<float>{1.0, 2.0, 0.5};
+    auto t = std::vector<float>{0.0, 1.0, 0.0};
+    auto dz = std::vector<float>(3);
+
+    const auto s = std::exp(1.0f) + std::exp(2.0f) + std::exp(0.5f);
+    AssertEqual(L.forward(z, t), std::log(s) - 2.0f);
+    AssertEqual(L.backward(z, t, dz.data()), std::log(s) - 2.0f);
+    AssertEqual(dz[0], std::exp(1.0f)/s);
+    AssertEqual(dz[1], std::exp(2.0f)/s - 1.0f);
+    AssertEqual(dz[2], std::exp(0.5f)/s);
+
+    // In-place
+    L.backward(z, t, z.data());
+    AssertEqual(z, dz);
+  }, "Softmax cross entropy");
+
+  test.Add([](){
+    auto L = SparseSoftmaxCrossEntropy<float>{};
+    auto id = std::vector<std::size_t>{7, 2, 5};
+    auto z = std::vector<float>{1.0, 2.0, 0.5};
+    auto label = std::vector<std::size_t>{2};
+
+    const auto lse = std::log(std::exp(1.0f) + std::exp(2.0f) + std::exp(0.5f));
+    AssertEqual(L.forward(id, z, label), lse - 2.0f);
+
+    AssertEqual(L.forward(id, z, std::vector<std::size_t>{}), 0);
+  }, "Sparse softmax cross entropy forward");
+
+  test.Add([](){
+    auto L = SparseSoftmaxCrossEntropy<float>{};
+    auto id = std::vector<std::size_t>{7, 2, 5};
+    auto z = std::vector<float>{1.0, 2.0, 0.5};
+    auto label = std::vector<std::size_t>{5, 7};
+    auto dz = std::vector<float>(3);
+
+    const auto s = std::exp(1.0f) + std::exp(2.0f) + std::exp(0.5f);
+    AssertEqual(L.backward(id, z, label, dz.data()), L.forward(id, z, label));
+    AssertEqual(dz[0], std::exp(1.0f)/s - 0.5f);
+    AssertEqual(dz[1], std::exp(2.0f)/s);
+    AssertEqual(dz[2], std::exp(0.5f)/s - 0.5f);
+    AssertEqual(dz[0] + dz[1] + dz[2], 0);
+  }, "Sparse softmax cross entropy backward");
+
+  test.Add([](){
+    auto L = SparseSoftmaxCrossEntropy<float>{};
+    auto id = std::vector<std::size_t>{0, 1};
+    auto z = std::vector<float>{1000.0, 0.0};
+
+    AssertEqual(L.forward(id, z, std::vector<std::size_t>{0}), 0);
+    AssertEqual(L.forward(id, z, std::vector<std::size_t>{1}), 1000);
+  }, "Sparse softmax cross entropy large logit");
+
+  test.Add([](){
+    auto L = SparseSoftmaxCrossEntropy<float>{};
+    auto id = std::vector<std::size_t>{0, 1};
+    auto z = std::vector<float>{0.0, 0.0};
+
+    AssertRaises<std::runtime_error>([&](){
+      L.forward(id, z, std::vector<std::size_t>{3});
+    }, "Label must be in class set");
+  }, "Sparse softmax cross entropy missing label");
+
+  return test.Run();
+}
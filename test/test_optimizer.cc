@@ -176,5 +176,125 @@ int main(int, char**){
     }
   }, "Adam multi client");
 
+  test.Add([](){
+    auto lr = 0.1;
+    auto decay = 0.5;
+    auto sgd = SGD<float>{lr, decay};
+    auto c = std::unique_ptr<OptimizerClient<float>>{sgd.client()};
+
+    AssertEqual(sgd.state_size(), 0);
+
+    auto w = std::vector<float>{0.0, 1.0, -2.0};
+    auto g = std::vector<float>{0.5, -0.3, 2.0};
+    auto expected = w;
+    for(std::size_t i=0; i<w.size(); ++i){ expected[i] += c->diff(g[i]); }
+
+    sgd.update(w, g, {}, {});
+    AssertEqual(w, expected);
+    AssertEqual(g, std::vector<float>{0.0, 0.0, 0.0});
+
+    sgd.step();
+    g = std::vector<float>{1.0, 1.0, 1.0};
+    for(std::size_t i=0; i<w.size(); ++i){ expected[i] += c->diff(g[i]); }
+    sgd.update(w, g, {}, {});
+    AssertEqual(w, expected);
+  }, "SGD span update");
+
+  test.Add([](){
+    auto adam = Adam<float>{1e-2};
+    auto c = std::unique_ptr<OptimizerClient<float>>{adam.client()};
+
+    AssertEqual(adam.state_size(), 2);
+
+    auto w = std::vector<float>{0.0, 1.0, -2.0};
+    auto m = std::vector<float>(w.size(), 0.0);
+    auto v = std::vector<float>(w.size(), 0.0);
+    auto g = std::vector<float>{};
+
+    auto expected = w;
+    for(auto x : {0.7, -0.2}){
+      g.assign(w.size(), x);
+      expected[1] += c->diff(x);
+
+      adam.update(w, g, m, v);
+      AssertEqual(w[1], expected[1]);
+      AssertEqual(g, std::vector<float>(w.size(), 0.0));
+
+      adam.step();
+    }
+  }, "Adam span update");
+
+  test.Add([](){
+    auto adam = Adam<float>{1e-2};
+
+    auto w = std::vector<float>{1.0, 1.0, 1.0};
+    auto m = std::vector<float>(w.size(), 0.0);
+    auto v = std::vector<float>(w.size(), 0.0);
+    auto g = std::vector<float>{0.5, 0.5, 0.5};
+    auto idx = std::vector<std::size_t>{0, 2};
+
+    adam.update(w, g, m, v, idx);
+    AssertNotEqual(w[0], 1.0);
+    AssertEqual(w[1], 1.0);
+    AssertEqual(w[2], w[0]);
+    AssertEqual(g, std::vector<float>{0.0, 0.5, 0.0});
+
+    auto sgd = SGD<float>{1.0};
+    g = std::vector<float>{0.5, 0.5, 0.5};
+    w = std::vector<float>{1.0, 1.0, 1.0};
+    sgd.update(w, g, {}, {}, std::vector<std::size_t>{1});
+    AssertEqual(w, std::vector<float>{1.0, 0.5, 1.0});
+  }, "Indexed span update");
+
+  test.Add([](){
+    auto adam = Adam<float>{1e-2, 0.9, 0.99, 1e-8, true};
+    auto dense = Adam<float>{1e-2, 0.9, 0.99};
+
+    AssertTrue(adam.lazy());
+    AssertFalse(dense.lazy());
+    AssertEqual(adam.steps(), 0);
+
+    auto w = std::vector<float>{1.0};
+    auto m = std::vector<float>{0.0};
+    auto v = std::vector<float>{0.0};
+    auto g = std::vector<float>{0.5};
+    adam.update(w, g, m, v);
+
+    auto m_dense = m;
+    auto v_dense = v;
+    auto w_dense = w;
+    for(auto i=0; i<3; ++i){
+      adam.step();
+      dense.update(w_dense, g, m_dense, v_dense);
+    }
+    AssertEqual(adam.steps(), 3);
+
+    adam.catch_up(m, v, 3);
+    AssertEqual(m, m_dense);
+    AssertEqual(v, v_dense);
+  }, "Lazy Adam catch up");
+
+  test.Add([](){
+    auto adam = Adam<float>{1e-2};
+    auto N = 10000;
+
+    auto w = std::vector<float>(N, 1.0);
+    auto m = std::vector<float>(N, 0.0);
+    auto v = std::vector<float>(N, 0.0);
+    auto g = std::vector<float>(N, 0.5);
+
+    auto w0 = std::vector<float>{1.0};
+    auto m0 = std::vector<float>{0.0};
+    auto v0 = std::vector<float>{0.0};
+    auto g0 = std::vector<float>{0.5};
+
+    adam.update(w, g, m, v);
+    adam.update(w0, g0, m0, v0);
+
+    AssertEqual(w, std::vector<float>(N, w0[0]));
+    AssertEqual(m, std::vector<float>(N, m0[0]));
+    AssertEqual(v, std::vector<float>(N, v0[0]));
+  }, "Adam parallel span update");
+
   return test.Run();
 }
@@ -1,7 +1,22 @@
+#include <cstdlib>
+#include <new>
+#include <thread>
+
 #include <slide.hh>
 
 #include "unittest.hh"
 
+// Heap allocation counter of the current thread
+thread_local std::size_t allocation = 0;
+
+void* operator new(std::size_t size){
+  ++allocation;
+  if(auto p = std::malloc(size)){ return p; }
+  throw std::bad_alloc{};
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
 int main(int, char**){
   using namespace HashDL;
 
@@ -12,31 +27,230 @@ int main(int, char**){
   auto sch = std::shared_ptr<Scheduler>{new ConstantFrequency{1}};
 
   test.Add([&](){
-    auto p = Param<float>{opt};
+    auto P = ParamStore<float>{1, 1, opt};
 
-    AssertEqual(p(), 0);
+    AssertEqual(P.weight(0, 0), 0);
+    AssertEqual(P.bias(0), 0);
 
-    p.add_grad(0.5);
-    AssertEqual(p(), 0);
+    P.add_weight_grad(0, 0, 0.5);
+    P.add_bias_grad(0, 0.2);
+    AssertEqual(P.weight(0, 0), 0);
+    AssertEqual(P.bias(0), 0);
 
-    p.update();
-    AssertEqual(p(), -0.5);
-  }, "Param");
+    P.update(0);
+    AssertEqual(P.weight(0, 0), -0.5);
+    AssertEqual(P.bias(0), -0.2);
+  }, "ParamStore");
 
   test.Add([&](){
-    auto p = Param<float>{opt, 0.5};
+    auto init = std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}};
+    auto P = ParamStore<float>{3, 5, opt, init};
+
+    AssertEqual(P.rows(), 3);
+    AssertEqual(P.cols(), 5);
+    AssertTrue(P.stride() >= P.cols());
+    for(std::size_t n=0; n<P.rows(); ++n){
+      AssertEqual(reinterpret_cast<std::uintptr_t>(P.weight(n)) % 64, 0);
+      AssertEqual(P.weight(n, 0), 0.5);
+      AssertEqual(P.weight(n, 4), 0.5);
+      AssertEqual(P.bias(n), 0);
+    }
+
+    P.add_weight_grad(1, 2, 0.5);
+    P.update();
+    AssertEqual(P.weight(0, 2), 0.5);
+    AssertEqual(P.weight(1, 2), 0);
+    AssertEqual(P.weight(2, 2), 0.5);
+  }, "ParamStore with initialization");
 
-    AssertEqual(p(), 0.5);
+  test.Add([&](){
+    auto adam = std::make_shared<Adam<float>>(0.1);
+    auto c = std::unique_ptr<OptimizerClient<float>>{adam->client()};
+    auto P = ParamStore<float>{2, 3, adam};
+
+    P.add_weight_grad(1, 2, 0.5);
+    P.add_bias_grad(1, 0.5);
+    P.update();
 
-    p.add_grad(0.5);
-    AssertEqual(p(), 0.5);
+    const auto expected = c->diff(0.5);
+    AssertEqual(P.weight(1, 2), expected);
+    AssertEqual(P.bias(1), expected);
+    AssertEqual(P.weight(1, 1), 0);
+    AssertEqual(P.weight(0, 2), 0);
+  }, "ParamStore with Adam");
 
-    p.update();
-    AssertEqual(p(), 0);
-  }, "Param with initialization");
+  test.Add([&](){
+    auto adam = std::make_shared<Adam<float>>(0.1);
+    auto P = ParamStore<float>{3, 3, adam};
+    auto rows = IndexSet{3};
+    auto cols = IndexSet{3};
+
+    P.add_weight_grad(1, 2, 0.5);
+    P.add_bias_grad(1, 0.5);
+    rows.insert(1);
+    cols.insert(2);
+    cols.insert(0);
+    P.update(rows, cols);
+
+    AssertNotEqual(P.weight(1, 2), 0);
+    AssertNotEqual(P.bias(1), 0);
+    AssertEqual(P.weight(1, 1), 0);
+    AssertEqual(P.weight(1, 0), 0);
+    AssertEqual(P.weight(0, 2), 0);
+    AssertEqual(P.bias(0), 0);
+    AssertEqual(P.weight(2, 2), 0);
+  }, "ParamStore sparse update");
+
+  test.Add([&](){
+    auto adam = std::make_shared<Adam<float>>(0.1, 0.9, 0.99, 1e-8, true);
+    auto P = ParamStore<float>{2, 1, adam};
+    auto rows = IndexSet{2};
+    auto cols = IndexSet{1};
+    cols.insert_all();
+
+    // Expected moments: updated at 1st and 4th step, skipped in between.
+    float m = 0, v = 0, w = 0;
+    auto step = [&](float g){
+      adam->step();
+      return adam->kernel()(m, v, g);
+    };
+
+    P.add_weight_grad(0, 0, 0.5);
+    rows.insert(0);
+    w += step(0.5);
+    P.update(rows, cols);
+    rows.clear();
+    AssertEqual(P.weight(0, 0), w);
+
+    for(auto i=0; i<2; ++i){
+      step(0);
+      P.update(rows, cols);
+    }
+    AssertEqual(P.weight(0, 0), w);
+
+    P.add_weight_grad(0, 0, 0.5);
+    rows.insert(0);
+    w += step(0.5);
+    P.update(rows, cols);
+    AssertEqual(P.weight(0, 0), w);
+    AssertEqual(P.weight(1, 0), 0);
+  }, "ParamStore lazy Adam");
+
+  test.Add([&](){
+    auto lazy = std::make_shared<Adam<float>>(0.1, 0.9, 0.99, 1e-8, true);
+    auto dense = std::make_shared<Adam<float>>(0.1, 0.9, 0.99, 1e-8, false);
+    auto P = ParamStore<float>{2, 4, lazy};
+    auto Q = ParamStore<float>{2, 4, dense};
+    auto rows = IndexSet{2};
+    auto cols = IndexSet{4};
+
+    // Every column receives gradient only at the 1st step,
+    // then prev_active is partial (columns 0 and 2).
+    for(auto i=0; i<4; ++i){
+      for(std::size_t c=0; c<4; ++c){
+	if((i > 0) && (c % 2)){ continue; }
+	P.add_weight_grad(0, c, 0.5);
+	Q.add_weight_grad(0, c, 0.5);
+	cols.insert(c);
+      }
+      rows.insert(0);
+
+      lazy->step();
+      dense->step();
+      P.update(rows, cols);
+      Q.update();
+      rows.clear();
+      cols.clear();
+
+      for(std::size_t c=0; c<4; ++c){ AssertEqual(P.weight(0, c), Q.weight(0, c)); }
+    }
+  }, "ParamStore lazy Adam partial columns");
+
+  test.Add([&](){
+    auto buf = GradientBuffer<float>{4, 16};
+
+    AssertFalse(buf.contains(2));
+    buf.weight(2)[1] += 0.5;
+    buf.bias(2) += 0.25;
+    buf.weight(0)[3] += 1.0;
+    AssertTrue(buf.contains(2));
+    AssertEqual(buf.rows(), std::vector<std::size_t>{2, 0});
+
+    auto gw = std::vector<float>(2, 0.0);
+    auto gb = 0.0f;
+    buf.flush(2, gw.data(), gb, gw.size());
+    AssertEqual(gw, std::vector<float>{0.0, 0.5});
+    AssertEqual(gb, 0.25);
+
+    buf.clear();
+    AssertFalse(buf.contains(2));
+    AssertEqual(buf.weight(1)[1], 0.0);
+  }, "GradientBuffer");
 
   test.Add([&](){
-    auto w = Weight<float>{1, opt};
+    auto atomic = ParamStore<float>{8, 5, opt, 0.01, 0.01, GradientMode::Atomic};
+    auto local = ParamStore<float>{8, 5, opt, 0.01, 0.01, GradientMode::PerThread};
+    auto x = Data<float>{std::vector<float>{0.1, 0.2, 0.3, 0.4, 0.5}};
+    auto prev = index_vec(5);
+
+    auto idx = index_vec(64);
+    for(auto P : {&atomic, &local}){
+      std::for_each(std::execution::par, idx.begin(), idx.end(), [&](auto i){
+	P->add_grad(i % 8, x, prev, 0.1 * (i % 3));
+	P->add_weight_grad(i % 4, i % 5, 0.2);
+      });
+      P->update();
+    }
+
+    for(std::size_t n=0; n<8; ++n){
+      AssertEqual(local.bias(n), atomic.bias(n));
+      for(std::size_t i=0; i<5; ++i){
+	AssertEqual(local.weight(n, i), atomic.weight(n, i));
+      }
+    }
+  }, "ParamStore per thread gradient");
+
+  test.Add([&](){
+    auto P = ParamStore<float>{2, 3, opt, 0, 0, GradientMode::Hogwild};
+    auto x = Data<float>{std::vector<float>{1.0, 2.0, 3.0}};
+
+    AssertTrue(P.is_hogwild());
+
+    P.add_grad(1, x, std::vector<std::size_t>{0, 2}, 0.5);
+    AssertEqual(P.weight(1, 0), -0.5);
+    AssertEqual(P.weight(1, 1), 0);
+    AssertEqual(P.weight(1, 2), -1.5);
+    AssertEqual(P.bias(1), -0.5);
+    AssertEqual(P.weight(0, 0), 0);
+
+    P.add_weight_grad(0, 1, 0.25);
+    AssertEqual(P.weight(0, 1), -0.25);
+    AssertEqual(P.bias(0), 0);
+
+    P.add_grad(1, x, std::vector<std::size_t>{1}, 0.5);
+    AssertEqual(P.weight(1, 0), -0.5);
+    AssertEqual(P.weight(1, 1), -1.0);
+  }, "ParamStore hogwild");
+
+  test.Add([&](){
+    auto idx = std::vector<std::size_t>{1, 1, 2};
+    auto value = std::vector<float>{1.0, 2.0, 3.0};
+    for(auto mode : {GradientMode::Atomic, GradientMode::PerThread, GradientMode::Hogwild}){
+      auto P = ParamStore<float>{1, 3, opt, 0, 0, mode};
+      P.add_grad(0, idx, std::span<const float>{value}, 0.5);
+      P.update();
+
+      // Gradients of duplicated index are summed.
+      AssertEqual(P.weight(0, 0), 0);
+      AssertEqual(P.weight(0, 1), -1.5);
+      AssertEqual(P.weight(0, 2), -1.5);
+      AssertEqual(P.bias(0), -0.5);
+    }
+  }, "ParamStore duplicated index");
+
+  test.Add([&](){
+    auto P = ParamStore<float>{1, 1, opt};
+    auto w = Weight<float>{P, 0};
 
     AssertEqual(w.weight(), std::vector<float>{0.0});
     AssertEqual(w.weight(0), 0);
@@ -46,7 +260,8 @@ int main(int, char**){
   }, "Weight");
 
   test.Add([&](){
-    auto w = Weight<float>{1, opt};
+    auto P = ParamStore<float>{1, 1, opt};
+    auto w = Weight<float>{P, 0};
 
     AssertEqual(w.weight(), std::vector<float>{0.0});
     AssertEqual(w.weight(0), 0);
@@ -75,7 +290,8 @@ int main(int, char**){
   }, "Weight update");
 
   test.Add([&](){
-    auto w = Weight<float>{2, opt};
+    auto P = ParamStore<float>{1, 2, opt};
+    auto w = Weight<float>{P, 0};
 
     AssertEqual(w.weight(), std::vector<float>{0.0, 0.0});
     AssertEqual(w.weight(0), 0);
@@ -86,7 +302,8 @@ int main(int, char**){
   }, "Multi dimension");
 
   test.Add([&](){
-    auto w = Weight<float>{1, opt, std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}}};
+    auto P = ParamStore<float>{1, 1, opt, std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}}};
+    auto w = Weight<float>{P, 0};
 
     AssertEqual(w.weight(), std::vector<float>{0.5});
     AssertEqual(w.weight(0), 0.5);
@@ -94,7 +311,20 @@ int main(int, char**){
   }, "Weight initialization");
 
   test.Add([&](){
-    auto N = Neuron<float>{1, opt};
+    auto P = ParamStore<float>{2, 1, opt};
+    auto w0 = Weight<float>{P, 0};
+    auto w1 = Weight<float>{P, 1};
+
+    w1.add_weight_grad(0, 0.5);
+    w1.update();
+    AssertEqual(w0.weight(0), 0);
+    AssertEqual(w1.weight(0), -0.5);
+    AssertEqual(P.weight(1, 0), -0.5);
+  }, "Weight view");
+
+  test.Add([&](){
+    auto P = ParamStore<float>{1, 1, opt};
+    auto N = Neuron<float>{P, 0};
 
     AssertEqual(N.w(), Data<float>{1});
     AssertEqual(N.forward(Data<float>{1}, std::vector<std::size_t>{} , a), 0);
@@ -102,7 +332,8 @@ int main(int, char**){
   }, "Neuron");
 
   test.Add([&](){
-    auto N = Neuron<float>{3, opt};
+    auto P = ParamStore<float>{1, 3, opt};
+    auto N = Neuron<float>{P, 0};
 
     AssertEqual(N.w(), Data<float>{3});
     AssertEqual(N.forward(Data<float>{1}, std::vector<std::size_t>{} , a), 0);
@@ -110,7 +341,8 @@ int main(int, char**){
   }, "Neuron multi prev");
 
   test.Add([&](){
-    auto N = Neuron<float>{1, opt};
+    auto P = ParamStore<float>{1, 1, opt};
+    auto N = Neuron<float>{P, 0};
 
     AssertEqual(N.w(), Data<float>{1});
     AssertEqual(N.forward(Data<float>{1}, std::vector<std::size_t>{} , a), 0);
@@ -127,7 +359,8 @@ int main(int, char**){
   }, "Neuron backward");
 
   test.Add([&](){
-    auto N = Neuron<float>{1, opt};
+    auto P = ParamStore<float>{1, 1, opt};
+    auto N = Neuron<float>{P, 0};
 
     auto x = Data<float>{std::vector<float>{1.0}};
     AssertEqual(N.w(), Data<float>{1});
@@ -150,10 +383,9 @@ int main(int, char**){
     auto d = 2;
     auto func = std::shared_ptr<HashFunc<float>>{new WTAFunc<float>{8, 1}};
     auto lsh = LSH<float>{L, d, func};
-    auto N = std::vector<Neuron<float>>{};
-    N.emplace_back(d, opt);
+    auto P = ParamStore<float>{1, d, opt};
 
-    lsh.add(N);
+    lsh.add(P);
   }, "LSH");
 
   test.Add([&](){
@@ -161,12 +393,11 @@ int main(int, char**){
     auto d = 2;
     auto func = std::shared_ptr<HashFunc<float>>{new WTAFunc<float>{8, 1}};
     auto lsh = LSH<float>{L, d, func};
-    auto N = std::vector<Neuron<float>>{};
-    N.emplace_back(d, opt);
-    lsh.add(N);
+    auto P = ParamStore<float>{1, d, opt};
+    lsh.add(P);
 
     lsh.reset();
-    lsh.add(N);
+    lsh.add(P);
   }, "LSH reset");
 
   test.Add([&](){
@@ -174,19 +405,182 @@ int main(int, char**){
     auto d = 2;
     auto func = std::shared_ptr<HashFunc<float>>{new WTAFunc<float>{8, 1}};
     auto lsh = LSH<float>{L, d, func};
-    auto N = std::vector<Neuron<float>>{};
-    N.emplace_back(d, opt);
-    lsh.add(N);
+    auto P = ParamStore<float>{1, d, opt};
+    lsh.add(P);
 
     auto x = Data<float>{d};
     AssertEqual(lsh.retrieve(x), lsh.retrieve(x));
 
     lsh.reset();
-    lsh.add(N);
+    lsh.add(P);
 
     AssertEqual(lsh.retrieve(x), lsh.retrieve(x));
   }, "LSH retrieve");
 
+  test.Add([&](){
+    auto L = 5;
+    auto d = 16;
+    auto func = std::shared_ptr<HashFunc<float>>{new WTAFunc<float>{4, 8}};
+    auto init = std::shared_ptr<Initializer<float>>{new GaussInitializer<float>{0, 1}};
+    auto lsh = LSH<float>{L, d, func};
+    auto P = ParamStore<float>{4, d, opt, init};
+    lsh.add(P);
+
+    auto codes = [&](){
+      auto c = std::vector<hashcode_t>{};
+      for(std::size_t n=0; n<P.rows(); ++n){
+	for(auto i=0; i<L; ++i){ c.push_back(lsh.code(n, i)); }
+      }
+      return c;
+    };
+
+    // Batch encoded add() must agree with row-wise re-encode of update()
+    auto added = codes();
+    lsh.update(P);
+    AssertEqual(codes(), added);
+
+    for(auto i=0; i<d; ++i){ P.weight(2)[i] = -P.weight(2)[i]; }
+    lsh.update(P, std::vector<std::size_t>{2});
+    auto updated = codes();
+    AssertNotEqual(updated, added);
+    for(auto i=0; i<L; ++i){ AssertEqual(lsh.size(i), P.rows()); }
+
+    lsh.update(P);
+    AssertEqual(codes(), updated);
+    for(auto i=0; i<L; ++i){ AssertEqual(lsh.size(i), P.rows()); }
+  }, "LSH incremental update");
+
+  test.Add([&](){
+    auto L = 5;
+    auto d = 16;
+    auto func = std::shared_ptr<HashFunc<float>>{new WTAFunc<float>{4, 8}};
+    auto table = std::shared_ptr<TableFunc>{new BucketArrayFunc{1, 2}};
+    auto init = std::shared_ptr<Initializer<float>>{new GaussInitializer<float>{0, 1}};
+    auto lsh = LSH<float>{L, d, func, 1.0, table};
+    auto P = ParamStore<float>{8, d, opt, init};
+    lsh.add(P);
+
+    // At most 2 neurons for each of 2 buckets
+    for(auto i=0; i<L; ++i){ AssertTrue(lsh.size(i) <= 4); }
+
+    auto x = Data<float>{d};
+    for(auto n : lsh.retrieve(x)){ AssertTrue(n < P.rows()); }
+
+    for(auto i=0; i<d; ++i){ P.weight(3)[i] = -P.weight(3)[i]; }
+    lsh.update(P, std::vector<std::size_t>{3});
+    for(auto i=0; i<L; ++i){ AssertTrue(lsh.size(i) <= 4); }
+  }, "LSH bucket array");
+
+  test.Add([&](){
+    auto L = 5;
+    auto d = 2;
+    auto func = std::shared_ptr<HashFunc<float>>{new WTAFunc<float>{8, 1}};
+    auto P = ParamStore<float>{4, d, opt};
+    auto x = Data<float>{d};
+
+    // Every neuron collides at every table
+    auto topk = LSH<float>{L, d, func, 0.5, {}, Retrieval::TopK};
+    topk.add(P);
+    AssertEqual(topk.retrieve(x), std::vector<std::size_t>{0, 1});
+
+    auto all = LSH<float>{L, d, func, 0.5, {}, Retrieval::Threshold, 5};
+    all.add(P);
+    AssertEqual(all.retrieve(x).size(), std::size_t{4});
+
+    auto none = LSH<float>{L, d, func, 0.5, {}, Retrieval::Threshold, 6};
+    none.add(P);
+    AssertEqual(none.retrieve(x).size(), std::size_t{0});
+  }, "LSH vote retrieval");
+
+  test.Add([&](){
+    auto L = 5;
+    auto d = 16;
+    auto func = std::shared_ptr<HashFunc<float>>{new DWTAFunc<float>{4, 8}};
+    auto init = std::shared_ptr<Initializer<float>>{new GaussInitializer<float>{0, 1}};
+    auto P = ParamStore<float>{32, d, opt, init};
+
+    auto x = Data<float>{d};
+    for(auto i=0; i<d; ++i){ x[i] = (i % 3) - 1.0; }
+
+    for(auto r : {Retrieval::Union, Retrieval::TopK, Retrieval::Threshold}){
+      for(std::size_t probes : {1, 4}){
+	auto lsh = LSH<float>{L, d, func, 0.5, {}, r, 2, probes};
+	lsh.add(P);
+
+	auto neuron_id = idx_t{};
+	neuron_id.reserve(P.rows());
+	lsh.retrieve(x, neuron_id); // Warm up
+
+	const auto before = allocation;
+	for(auto i=0; i<10; ++i){ lsh.retrieve(x, neuron_id); }
+	AssertEqual(allocation - before, std::size_t{0});
+      }
+    }
+  }, "LSH retrieve allocation free");
+
+  test.Add([&](){
+    auto L = 3;
+    auto d = 16;
+    auto init = std::shared_ptr<Initializer<float>>{new GaussInitializer<float>{0, 1}};
+    auto P = ParamStore<float>{64, d, opt, init};
+
+    // Both LSH share the same hash functions.
+    auto wta = std::vector<WTA<float>>{};
+    for(auto i=0; i<L; ++i){ wta.emplace_back(4, d, 8); }
+    struct CopyFunc : public HashFunc<float> {
+      const std::vector<WTA<float>>& wta;
+      std::size_t i;
+      CopyFunc(const std::vector<WTA<float>>& wta): wta{wta}, i{0} {}
+      Hash<float>* GetHash(std::size_t) override { return new WTA<float>{wta[i++]}; }
+    };
+
+    auto single = LSH<float>{L, d, std::shared_ptr<HashFunc<float>>{new CopyFunc{wta}},
+			     1.0, {}, Retrieval::Threshold, 1, 1};
+    auto multi = LSH<float>{L, d, std::shared_ptr<HashFunc<float>>{new CopyFunc{wta}},
+			    1.0, {}, Retrieval::Threshold, 1, 8};
+    single.add(P);
+    multi.add(P);
+
+    std::size_t single_size = 0, multi_size = 0;
+    for(std::size_t n=0; n<P.rows(); ++n){
+      const auto x = Data<float>{P.weight(n), P.weight(n) + d};
+      auto s = single.retrieve(x);
+      auto m = multi.retrieve(x);
+      std::sort(s.begin(), s.end());
+      std::sort(m.begin(), m.end());
+
+      AssertTrue(std::binary_search(s.begin(), s.end(), n));
+      AssertTrue(std::includes(m.begin(), m.end(), s.begin(), s.end()));
+      single_size += s.size();
+      multi_size += m.size();
+    }
+    AssertTrue(multi_size > single_size);
+  }, "LSH multi-probe");
+
+  test.Add([&](){
+    const std::size_t d = 5;
+    auto x = Data<float>{std::vector<float>{0.0, 0.3, 0.0, 0.0, 0.7}};
+    auto idx = std::vector<std::size_t>{1, 4};
+    auto value = std::vector<float>{0.3, 0.7};
+
+    auto srp = std::shared_ptr<HashFunc<float>>{new SRPFunc<float>{8, 2}};
+    auto doph = std::shared_ptr<HashFunc<float>>{new DOPHFunc<float>{4, 8}};
+    for(auto& func : {wta, srp, doph}){
+      for(std::size_t probes : {1, 4}){
+	auto lsh = LSH<float>{10, d, func, 1.0, {}, Retrieval::Threshold, 1, probes};
+	auto P = ParamStore<float>{6, d, opt};
+	lsh.add(P);
+
+	auto dense = lsh.retrieve(x);
+	auto sparse = idx_t{};
+	lsh.retrieve(idx, value, sparse);
+	std::sort(dense.begin(), dense.end());
+	std::sort(sparse.begin(), sparse.end());
+	AssertEqual(dense, sparse);
+      }
+    }
+  }, "LSH sparse retrieve");
+
   test.Add([&](){
     auto dsize = 1;
     auto input = std::make_shared<InputLayer<float>>(dsize);
@@ -286,6 +680,82 @@ int main(int, char**){
     output->backward(0, x);
   },"Multi unite Dense");
 
+  test.Add([&](){
+    auto dsize = 4;
+    auto L = 5;
+    auto init = std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}};
+    auto input = std::shared_ptr<Layer<float>>{new InputLayer<float>{dsize}};
+    auto hidden = std::shared_ptr<Layer<float>>{new DenseLayer<float>{dsize, dsize, a, L, wta, opt, init}};
+    auto output = std::shared_ptr<Layer<float>>{new OutputLayer<float>{dsize}};
+
+    input->set_next(hidden);
+    hidden->set_prev(input);
+
+    hidden->set_next(output);
+    output->set_prev(hidden);
+
+    auto x = Data<float>{std::vector<float>{0.1, 0.2, 0.3, 0.4}};
+    for(auto& L : {input, hidden, output}){ L->reset(2); }
+    input->forward(0, x);
+    input->forward(1, x);
+    output->backward(0, x);
+    output->backward(1, x);
+    AssertTrue(hidden->sparse(0));
+    AssertEqual(hidden->active_value(0).size(), hidden->active_id(0).size());
+    AssertTrue(!hidden->active_id(0).empty());
+    const auto y0 = hidden->active_value(0).data();
+    const auto dy0 = std::to_address(hidden->grad(0).begin());
+
+    // Gradient is aligned with active neurons.
+    const auto& active = hidden->active_id(0);
+    AssertEqual(hidden->grad(0).size(), active.size());
+    for(std::size_t j=0; j<active.size(); ++j){ AssertEqual(hidden->grad(0)[j], x[active[j]]); }
+
+    // Buffers are reused.
+    for(auto& L : {input, hidden, output}){ L->reset(1); }
+    AssertEqual(std::to_address(hidden->grad(0).begin()), dy0);
+
+    auto y = input->forward(0, x);
+    AssertEqual(hidden->active_value(0).data(), y0);
+    for(auto& L : {input, hidden, output}){ L->reset(1); }
+    AssertEqual(input->forward(0, x), y);
+  }, "Dense Layer reuse buffer");
+
+  test.Add([&](){
+    auto dsize = 4;
+    auto L = 5;
+    auto init = std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}};
+    auto x = Data<float>{std::vector<float>{-0.1, 0.2, -0.3, 0.4}};
+
+    auto run = [&](auto hidden){
+      auto input = std::shared_ptr<Layer<float>>{new InputLayer<float>{dsize}};
+      auto output = std::shared_ptr<Layer<float>>{new OutputLayer<float>{dsize}};
+      input->set_next(hidden);
+      hidden->set_prev(input);
+      hidden->set_next(output);
+      output->set_prev(hidden);
+      for(auto& L : {input, hidden, output}){ L->reset(1); }
+      return input->forward(0, x);
+    };
+
+    auto acts = std::vector<std::shared_ptr<Activation<float>>>{
+      std::shared_ptr<Activation<float>>{new Linear<float>{}},
+      std::shared_ptr<Activation<float>>{new ReLU<float>{}},
+      std::shared_ptr<Activation<float>>{new Sigmoid<float>{}}
+    };
+    for(auto& f : acts){
+      auto generic = std::shared_ptr<Layer<float>>{
+	new DenseLayer<float>{dsize, dsize, f, L, wta, opt, init}
+      };
+      auto special = make_dense_layer<float>(dsize, dsize, f, L, wta, opt, init);
+      AssertEqual(run(generic), run(special));
+    }
+
+    AssertRaises<std::runtime_error>([&](){
+      DenseLayer<float, ReLU<float>>{dsize, dsize, a, L, wta, opt, init};
+    }, "DenseLayer<float, ReLU<float>> with Linear<float>");
+  }, "Dense Layer activation specialization");
+
   test.Add([&](){
     auto Net = Network<float>(1, std::vector<std::size_t>{1}, 10, wta, opt, sch);
 
@@ -325,5 +795,436 @@ int main(int, char**){
     AssertEqual(Net(x1), x1);
   }, "No hidden network");
 
+  test.Add([&](){
+    // WTA with sample_size 1 always returns the same code, so that
+    // both networks activate the same neurons.
+    auto init = std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}};
+    auto sgd = std::shared_ptr<Optimizer<float>>{new SGD<float>{0.1}};
+    auto dense = Network<float>(3, std::vector<std::size_t>{4, 2}, 10, wta, sgd, sch,
+				a, init, 0, 0, 0.5, NetworkOption{.sparse_update = false});
+    auto sparse = Network<float>(3, std::vector<std::size_t>{4, 2}, 10, wta, sgd, sch,
+				 a, init, 0, 0, 0.5, NetworkOption{.sparse_update = true});
+
+    auto x = std::vector<float>{0.1, 0.2, 0.3, 0.4, 0.5, 0.6};
+    auto X = BatchView<float>{3, 2, x.data()};
+    auto y = std::vector<float>{1.0, -1.0, 0.5, 0.2};
+    auto dY = BatchView<float>{2, 2, y.data()};
+
+    for(auto i=0; i<3; ++i){
+      dense(X);
+      dense.backward(dY);
+      sparse(X);
+      sparse.backward(dY);
+      AssertEqual(dense(X), sparse(X));
+    }
+  }, "Network sparse update");
+
+  test.Add([&](){
+    auto init = std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}};
+    auto sgd = std::shared_ptr<Optimizer<float>>{new SGD<float>{0.01}};
+    auto atomic = Network<float>(3, std::vector<std::size_t>{4, 2}, 10, wta, sgd, sch,
+				 a, init, 0, 0, 0.5,
+				 NetworkOption{.gradient = GradientMode::Atomic});
+    auto local = Network<float>(3, std::vector<std::size_t>{4, 2}, 10, wta, sgd, sch,
+				a, init, 0, 0, 0.5,
+				NetworkOption{.gradient = GradientMode::PerThread});
+
+    const std::size_t batch = 64;
+    auto x = std::vector<float>(3 * batch, 0.3);
+    auto X = BatchView<float>{3, batch, x.data()};
+    auto y = std::vector<float>(2 * batch, 0.1);
+    auto dY = BatchView<float>{2, batch, y.data()};
+
+    for(auto i=0; i<3; ++i){
+      atomic(X);
+      atomic.backward(dY);
+      local(X);
+      local.backward(dY);
+      AssertEqual(atomic(X), local(X));
+    }
+  }, "Network per thread gradient");
+
+  test.Add([&](){
+    auto init = std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}};
+    auto sgd = std::shared_ptr<Optimizer<float>>{new SGD<float>{0.01}};
+    auto atomic = Network<float>(3, std::vector<std::size_t>{4, 2}, 10, wta, sgd, sch,
+				 a, init, 0, 0, 0.5,
+				 NetworkOption{.gradient = GradientMode::Atomic});
+    auto hogwild = Network<float>(3, std::vector<std::size_t>{4, 2}, 10, wta, sgd, sch,
+				  a, init, 0, 0, 0.5,
+				  NetworkOption{.gradient = GradientMode::Hogwild});
+
+    // Single sample batch is same as synchronous update
+    auto x = std::vector<float>{0.1, 0.2, 0.3};
+    auto X = BatchView<float>{3, 1, x.data()};
+    auto y = std::vector<float>{0.5, -0.5};
+    auto dY = BatchView<float>{2, 1, y.data()};
+
+    for(auto i=0; i<3; ++i){
+      atomic(X);
+      atomic.backward(dY);
+      hogwild(X);
+      hogwild.backward(dY);
+      AssertEqual(atomic(X), hogwild(X));
+    }
+
+    // Same bias correction of Adam (sparse update touches same parameters)
+    auto adam_atomic = Network<float>(3, std::vector<std::size_t>{4, 2}, 10, wta,
+				      std::make_shared<Adam<float>>(0.01), sch, a, init,
+				      0, 0, 0.5, NetworkOption{.sparse_update = true});
+    auto adam_hogwild = Network<float>(3, std::vector<std::size_t>{4, 2}, 10, wta,
+				       std::make_shared<Adam<float>>(0.01), sch, a, init,
+				       0, 0, 0.5,
+				       NetworkOption{.sparse_update = true,
+						     .gradient = GradientMode::Hogwild});
+    for(auto i=0; i<3; ++i){
+      adam_atomic(X);
+      adam_atomic.backward(dY);
+      adam_hogwild(X);
+      adam_hogwild.backward(dY);
+      AssertEqual(adam_atomic(X), adam_hogwild(X));
+    }
+
+    // Large batch runs concurrently
+    const std::size_t batch = 64;
+    auto xx = std::vector<float>(3 * batch, 0.3);
+    auto XX = BatchView<float>{3, batch, xx.data()};
+    auto yy = std::vector<float>(2 * batch, 0.1);
+    auto dYY = BatchView<float>{2, batch, yy.data()};
+    hogwild(XX);
+    hogwild.backward(dYY);
+  }, "Network hogwild");
+
+  test.Add([&](){
+    auto init = std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}};
+    auto sgd = std::shared_ptr<Optimizer<float>>{new SGD<float>{0.1}};
+
+    auto x = std::vector<float>{0.1, 0.2, 0.3, 0.4, 0.5, 0.6};
+    auto X = BatchView<float>{3, 2, x.data()};
+    auto y = std::vector<float>{1.0, -1.0, 0.5, 0.2};
+    auto dY = BatchView<float>{2, 2, y.data()};
+
+    for(auto sparse_update : {true, false}){
+      auto full = Network<float>(3, std::vector<std::size_t>{4, 2}, 10, wta, sgd, sch,
+				 a, init, 0, 0, 0.5,
+				 NetworkOption{.sparse_update = sparse_update});
+      auto incremental = Network<float>(3, std::vector<std::size_t>{4, 2}, 10, wta, sgd, sch,
+					a, init, 0, 0, 0.5,
+					NetworkOption{.sparse_update = sparse_update,
+						      .incremental_rehash = true});
+      for(auto i=0; i<3; ++i){
+	full(X);
+	full.backward(dY);
+	incremental(X);
+	incremental.backward(dY);
+	AssertEqual(full(X), incremental(X));
+      }
+    }
+  }, "Network incremental rehash");
+
+  test.Add([&](){
+    auto init = std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}};
+    auto sgd = std::shared_ptr<Optimizer<float>>{new SGD<float>{0.1}};
+    auto table = std::shared_ptr<TableFunc>{new BucketArrayFunc{4, 8}};
+
+    // All neurons fit in a single bucket
+    auto map = Network<float>(3, std::vector<std::size_t>{4, 2}, 10, wta, sgd, sch,
+			      a, init, 0, 0, 0.5);
+    auto array = Network<float>(3, std::vector<std::size_t>{4, 2}, 10, wta, sgd, sch,
+				a, init, 0, 0, 0.5, NetworkOption{.table = table});
+
+    auto x = std::vector<float>{0.1, 0.2, 0.3, 0.4, 0.5, 0.6};
+    auto X = BatchView<float>{3, 2, x.data()};
+    auto y = std::vector<float>{1.0, -1.0, 0.5, 0.2};
+    auto dY = BatchView<float>{2, 2, y.data()};
+
+    for(auto i=0; i<3; ++i){
+      map(X);
+      map.backward(dY);
+      array(X);
+      array.backward(dY);
+      AssertEqual(map(X), array(X));
+    }
+  }, "Network bucket array");
+
+  test.Add([&](){
+    const std::size_t L = 8, d = 64, topk = 8;
+    auto doph = std::shared_ptr<HashFunc<float>>{new DOPHFunc<float>{2, 8, 100, topk}};
+    auto init = std::shared_ptr<Initializer<float>>{new GaussInitializer<float>{0, 1}};
+    auto P = ParamStore<float>{32, d, opt, init};
+    auto lsh = LSH<float>{L, d, doph, 1.0, {}, Retrieval::Threshold, 1};
+    lsh.add(P);
+
+    // Gaussian neurons are spread over buckets instead of a single one.
+    for(std::size_t i=0; i<L; ++i){
+      auto codes = std::vector<hashcode_t>{};
+      for(std::size_t n=0; n<P.rows(); ++n){ codes.push_back(lsh.code(n, i)); }
+      std::sort(codes.begin(), codes.end());
+      AssertTrue(std::unique(codes.begin(), codes.end()) - codes.begin() > 1);
+    }
+
+    // Sparse binary input on the largest weights retrieves the neuron.
+    for(std::size_t n=0; n<P.rows(); ++n){
+      const auto w = P.weight(n);
+      auto idx = std::vector<std::size_t>(d);
+      std::iota(idx.begin(), idx.end(), 0);
+      std::sort(idx.begin(), idx.end(),
+		[w](auto a, auto b){ return std::abs(w[a]) > std::abs(w[b]); });
+      idx.resize(topk);
+      auto value = std::vector<float>(topk, 1);
+
+      auto id = idx_t{};
+      lsh.retrieve(idx, value, id);
+      AssertTrue(std::find(id.begin(), id.end(), n) != id.end());
+    }
+
+    // Update with the same weights keeps codes.
+    auto before = std::vector<hashcode_t>{};
+    for(std::size_t n=0; n<P.rows(); ++n){ before.push_back(lsh.code(n, 0)); }
+    lsh.update(P);
+    for(std::size_t n=0; n<P.rows(); ++n){ AssertEqual(lsh.code(n, 0), before[n]); }
+  }, "LSH DOPH neuron");
+
+  test.Add([&](){
+    auto init = std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}};
+    auto sgd = std::shared_ptr<Optimizer<float>>{new SGD<float>{0.1}};
+    auto dense = Network<float>(3, std::vector<std::size_t>{4, 2}, 10, wta, sgd, sch,
+				a, init);
+    auto csr = Network<float>(3, std::vector<std::size_t>{4, 2}, 10, wta, sgd, sch,
+			      a, init);
+
+    auto x = std::vector<float>{0.0, 0.2, 0.0, 0.4, 0.0, 0.6};
+    auto X = BatchView<float>{3, 2, x.data()};
+    auto indptr = std::vector<std::size_t>{0, 1, 3};
+    auto indices = std::vector<std::size_t>{1, 0, 2};
+    auto values = std::vector<float>{0.2, 0.4, 0.6};
+    auto C = CSRView<float>{3, 2, indptr.data(), indices.data(), values.data()};
+    auto y = std::vector<float>{1.0, -1.0, 0.5, 0.2};
+    auto dY = BatchView<float>{2, 2, y.data()};
+
+    for(auto i=0; i<3; ++i){
+      AssertEqual(dense(X), csr(C));
+      dense.backward(dY);
+      csr.backward(dY);
+    }
+
+    using Assert_t = AssertRaises<std::runtime_error>;
+    auto wide = std::vector<std::size_t>{1, 0, 400000};
+    Assert_t([&](){ csr(CSRView<float>{400001, 2, indptr.data(), wide.data(), values.data()}); },
+	     "CSR width mismatch");
+    Assert_t([&](){ csr(CSRView<float>{3, 2, indptr.data(), wide.data(), values.data()}); },
+	     "CSR index out of range");
+    auto dup = std::vector<std::size_t>{1, 0, 0};
+    Assert_t([&](){ csr(CSRView<float>{3, 2, indptr.data(), dup.data(), values.data()}); },
+	     "CSR index duplicated");
+    Assert_t([&](){ dense(BatchView<float>{2, 3, x.data()}); }, "Dense width mismatch");
+  }, "Network CSR input");
+
+  test.Add([&](){
+    auto init = std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}};
+    auto sgd = std::shared_ptr<Optimizer<float>>{new SGD<float>{0.1}};
+    auto option = NetworkOption{};
+    option.execution = Execution::LayerWise;
+    auto units = std::vector<std::size_t>{4, 3, 2};
+    auto sample = Network<float>(3, units, 10, wta, sgd, sch, a, init);
+    auto layer = Network<float>(3, units, 10, wta, sgd, sch, a, init, 0, 0, 0.5, option);
+    auto csr = Network<float>(3, units, 10, wta, sgd, sch, a, init, 0, 0, 0.5, option);
+
+    auto x = std::vector<float>{0.0, 0.2, 0.0, 0.4, 0.0, 0.6};
+    auto X = BatchView<float>{3, 2, x.data()};
+    auto indptr = std::vector<std::size_t>{0, 1, 3};
+    auto indices = std::vector<std::size_t>{1, 0, 2};
+    auto values = std::vector<float>{0.2, 0.4, 0.6};
+    auto C = CSRView<float>{3, 2, indptr.data(), indices.data(), values.data()};
+    auto y = std::vector<float>{1.0, -1.0, 0.5, 0.2};
+    auto dY = BatchView<float>{2, 2, y.data()};
+
+    for(auto i=0; i<3; ++i){
+      auto Y = sample(X);
+      AssertEqual(Y, layer(X));
+      AssertEqual(Y, csr(C));
+      sample.backward(dY);
+      layer.backward(dY);
+      csr.backward(dY);
+    }
+  }, "Network layer-wise execution");
+
+  test.Add([&](){
+    auto init = std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}};
+    auto sgd = std::shared_ptr<Optimizer<float>>{new SGD<float>{0.1}};
+    auto relu = std::shared_ptr<Activation<float>>{new ReLU<float>{}};
+    auto option = NetworkOption{};
+    option.output = Output::SampledSoftmax;
+    // Nothing is retrieved, so that active classes are exactly true labels.
+    option.retrieval = Retrieval::Threshold;
+    option.min_votes = 11;
+    auto units = std::vector<std::size_t>{4, 6};
+    auto sample = Network<float>(3, units, 10, wta, sgd, sch, relu, init, 0, 0, 0.5, option);
+    option.execution = Execution::LayerWise;
+    auto layer = Network<float>(3, units, 10, wta, sgd, sch, relu, init, 0, 0, 0.5, option);
+
+    auto x = std::vector<float>{0.0, 0.2, 0.0, 0.4, 0.0, 0.6};
+    auto X = BatchView<float>{3, 2, x.data()};
+    auto indptr = std::vector<std::size_t>{0, 1, 3};
+    auto indices = std::vector<std::size_t>{3, 1, 4};
+    auto label = LabelView{2, indptr.data(), indices.data()};
+
+    // Equal logits of 2 labels: log(2), single label: 0
+    for(auto i=0; i<3; ++i){
+      AssertEqual(sample.loss(X, label), std::log(2.0f) / 2);
+      AssertEqual(layer.loss(X, label), std::log(2.0f) / 2);
+      sample.backward();
+      layer.backward();
+    }
+
+    // Dense logits without label
+    AssertEqual(sample(X).get_data_size(), 6);
+    AssertEqual(sample(X), layer(X));
+
+    auto out = std::vector<std::size_t>{0, 6, 0};
+    AssertRaises<std::runtime_error>([&](){
+      sample.loss(X, LabelView{2, indptr.data(), out.data()});
+    }, "Label must be less than number of classes");
+
+    auto identity = Network<float>(3, units, 10, wta, sgd, sch, relu, init);
+    AssertRaises<std::runtime_error>([&](){ identity.loss(X, label); },
+				     "Loss requires sampled softmax output");
+
+    AssertRaises<std::runtime_error>([&](){
+      Network<float>(3, std::vector<std::size_t>{}, 10, wta, sgd, sch, relu, init,
+		     0, 0, 0.5, option);
+    }, "Sampled softmax requires hidden layer");
+  }, "Network sampled softmax");
+
+  test.Add([&](){
+    const auto inf = std::numeric_limits<float>::infinity();
+
+    // Retrieved logits are all negative, so that 0 would be argmax.
+    auto layer = SampledSoftmaxLayer<float>{4};
+    layer.reset(1);
+    auto i = std::vector<std::size_t>{1, 3};
+    auto v = std::vector<float>{-2, -1};
+    AssertEqual(layer.forward(0, i, v), Data<float>{std::vector<float>{-inf, -2, -inf, -1}});
+    AssertEqual(OutputLayer<float>{4}.missing(), 0.0f);
+
+    auto init = std::shared_ptr<Initializer<float>>{new GaussInitializer<float>{-5, 1}};
+    auto sgd = std::shared_ptr<Optimizer<float>>{new SGD<float>{0.1}};
+    auto option = NetworkOption{};
+    option.output = Output::SampledSoftmax;
+    auto units = std::vector<std::size_t>{6};
+    auto x = std::vector<float>{0.1, 0.2, 0.3, 0.4, 0.5, 0.6};
+    auto X = BatchView<float>{3, 2, x.data()};
+
+    auto sample = Network<float>(3, units, 10, wta, sgd, sch, a, init, 0, 0, 0.5, option);
+    auto P = sample.predict(X);
+    AssertEqual(sample(X), P);
+    for(std::size_t n=0; n<2; ++n){
+      for(auto it = P.begin(n); it != P.end(n); ++it){ AssertTrue(*it < 0); }
+    }
+
+    // Nothing is retrieved.
+    option.retrieval = Retrieval::Threshold;
+    option.min_votes = 11;
+    for(auto e : {Execution::Sample, Execution::LayerWise}){
+      option.execution = e;
+      auto none = Network<float>(3, units, 10, wta, sgd, sch, a, init, 0, 0, 0.5, option);
+      auto Y = none(X);
+      AssertEqual(none.predict(X), Y);
+      for(auto y : Y){ AssertEqual(y, -inf); }
+    }
+  }, "Network sampled softmax unretrieved logits");
+
+  test.Add([&](){
+    auto init = std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}};
+    auto sgd = std::shared_ptr<Optimizer<float>>{new SGD<float>{0.1}};
+    auto units = std::vector<std::size_t>{4, 3};
+    auto fused = Network<float>(3, units, 10, wta, sgd, sch, a, init);
+    auto manual = Network<float>(3, units, 10, wta, sgd, sch, a, init);
+
+    auto x = std::vector<float>{0.0, 0.2, 0.0, 0.4, 0.0, 0.6};
+    auto X = BatchView<float>{3, 2, x.data()};
+    auto t = std::vector<float>{0.0, 1.0, 0.0, 1.0, 0.0, 0.0};
+    auto T = BatchView<float>{3, 2, t.data()};
+    auto f = SoftmaxCrossEntropy<float>{};
+
+    for(auto i=0; i<3; ++i){
+      auto Y = manual(X);
+      float L = 0;
+      for(std::size_t n=0; n<2; ++n){
+	auto y = std::to_address(Y.begin(n));
+	L += f.backward({y, 3}, {T.begin(n), 3}, y) / 2;
+      }
+      manual.backward(BatchView<float>{3, 2, std::to_address(Y.begin())});
+
+      AssertEqual(fused.train_step(X, T), L);
+    }
+    AssertEqual(fused(X), manual(X));
+
+    auto wrong = BatchView<float>{2, 3, t.data()};
+    AssertRaises<std::runtime_error>([&](){ fused.train_step(X, wrong); },
+				     "Target shape must be [batch_size, output_size]");
+
+    auto option = NetworkOption{};
+    option.output = Output::SampledSoftmax;
+    auto sampled_fused = Network<float>(3, units, 10, wta, sgd, sch, a, init, 0, 0, 0.5, option);
+    auto sampled_manual = Network<float>(3, units, 10, wta, sgd, sch, a, init, 0, 0, 0.5, option);
+    auto indptr = std::vector<std::size_t>{0, 1, 2};
+    auto indices = std::vector<std::size_t>{1, 0};
+    auto label = LabelView{2, indptr.data(), indices.data()};
+    for(auto i=0; i<3; ++i){
+      const auto L = sampled_manual.loss(X, label);
+      sampled_manual.backward();
+      AssertEqual(sampled_fused.train_step(X, label), L);
+    }
+  }, "Network train step");
+
+  test.Add([&](){
+    auto init = std::shared_ptr<Initializer<float>>{new ConstantInitializer<float>{0.5}};
+    auto sgd = std::shared_ptr<Optimizer<float>>{new SGD<float>{0.1}};
+    auto net = Network<float>(3, std::vector<std::size_t>{4, 3, 2}, 10, wta, sgd, sch,
+			      a, init);
+
+    auto x = std::vector<float>{0.0, 0.2, 0.0, 0.4, 0.0, 0.6};
+    auto X = BatchView<float>{3, 2, x.data()};
+    auto indptr = std::vector<std::size_t>{0, 1, 3};
+    auto indices = std::vector<std::size_t>{1, 0, 2};
+    auto values = std::vector<float>{0.2, 0.4, 0.6};
+    auto C = CSRView<float>{3, 2, indptr.data(), indices.data(), values.data()};
+    auto y = std::vector<float>{1.0, -1.0, 0.5, 0.2};
+    auto dY = BatchView<float>{2, 2, y.data()};
+
+    for(auto i=0; i<2; ++i){
+      auto Y = net(X);
+      AssertEqual(net.predict(X), Y);
+      AssertEqual(net.predict(C), Y);
+
+      // Concurrent inference on the same model
+      auto results = std::vector<BatchData<float>>(4);
+      auto threads = std::vector<std::thread>{};
+      for(auto& r : results){
+	threads.emplace_back([&](){ r = net.predict(X); });
+      }
+      for(auto& t : threads){ t.join(); }
+      for(auto& r : results){ AssertEqual(r, Y); }
+
+      // Training state is not overwritten by predict.
+      net.backward(dY);
+    }
+
+    auto no_hidden = Network<float>(3, std::vector<std::size_t>{}, 10, wta, sgd, sch);
+    AssertEqual(no_hidden.predict(X), x);
+    AssertEqual(no_hidden.predict(C), x);
+
+    using Assert_t = AssertRaises<std::runtime_error>;
+    auto wide = std::vector<std::size_t>{1, 0, 3};
+    for(auto* n : {&net, &no_hidden}){
+      Assert_t([&](){ n->predict(BatchView<float>{2, 3, x.data()}); }, "Dense width mismatch");
+      Assert_t([&](){ n->predict(CSRView<float>{4, 2, indptr.data(), indices.data(), values.data()}); },
+	       "CSR width mismatch");
+      Assert_t([&](){ n->predict(CSRView<float>{3, 2, indptr.data(), wide.data(), values.data()}); },
+	       "CSR index out of range");
+    }
+  }, "Network predict");
+
   return test.Run();
 }
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <table.hh>
+
+#include "unittest.hh"
+
+int main(int, char**){
+  using namespace HashDL;
+
+  auto test = Test{};
+
+  auto sorted = [](std::span<const neuron_t> s){
+    auto v = std::vector<std::size_t>(s.begin(), s.end());
+    std::sort(v.begin(), v.end());
+    return v;
+  };
+
+  test.Add([=](){
+    auto table = MapTable{};
+    table.insert(1, 10);
+    table.insert(1, 11);
+    table.insert(2, 12);
+
+    AssertEqual(table.size(), std::size_t{3});
+    AssertEqual(sorted(table.find(1)), std::vector<std::size_t>{10, 11});
+    AssertEqual(table.find(3).size(), std::size_t{0});
+
+    table.erase(1, 10);
+    table.erase(1, 12);
+    AssertEqual(table.size(), std::size_t{2});
+    AssertEqual(sorted(table.find(1)), std::vector<std::size_t>{11});
+
+    table.clear();
+    AssertEqual(table.size(), std::size_t{0});
+    AssertEqual(table.find(2).size(), std::size_t{0});
+  }, "MapTable");
+
+  test.Add([=](){
+    auto table = BucketArray{2, 4};
+    table.insert(1, 10);
+    table.insert(5, 11); // Same lower bits
+    table.insert(2, 12);
+
+    AssertEqual(table.size(), std::size_t{3});
+    AssertEqual(sorted(table.find(1)), std::vector<std::size_t>{10, 11});
+    AssertEqual(sorted(table.find(6)), std::vector<std::size_t>{12});
+
+    table.erase(1, 10);
+    AssertEqual(sorted(table.find(5)), std::vector<std::size_t>{11});
+
+    table.clear();
+    AssertEqual(table.size(), std::size_t{0});
+    AssertEqual(table.find(1).size(), std::size_t{0});
+  }, "BucketArray");
+
+  test.Add([=](){
+    auto table = BucketArray{1, 3, Overflow::FIFO};
+    for(std::size_t n=0; n<5; ++n){ table.insert(0, n); }
+
+    AssertEqual(table.size(), std::size_t{3});
+    auto b = table.find(0);
+    AssertEqual(std::vector<std::size_t>(b.begin(), b.end()),
+		std::vector<std::size_t>{2, 3, 4});
+
+    table.erase(0, 3);
+    table.insert(0, 5);
+    b = table.find(0);
+    AssertEqual(std::vector<std::size_t>(b.begin(), b.end()),
+		std::vector<std::size_t>{2, 4, 5});
+  }, "BucketArray FIFO");
+
+  test.Add([=](){
+    auto table = BucketArray{1, 3, Overflow::Reservoir};
+    for(std::size_t n=0; n<100; ++n){ table.insert(0, n); }
+
+    AssertEqual(table.size(), std::size_t{3});
+    auto b = sorted(table.find(0));
+    AssertEqual(b.size(), std::size_t{3});
+    AssertTrue(std::adjacent_find(b.begin(), b.end()) == b.end());
+    AssertTrue(b.back() < 100);
+  }, "BucketArray reservoir");
+
+  test.Add([=](){
+    // After erase/insert cycles, the bucket has seen only 1 live neuron,
+    // so that a newcomer replaces it with probability 1/2.
+    const std::size_t trials = 4000;
+    std::size_t replaced = 0;
+    for(std::size_t t=0; t<trials; ++t){
+      auto table = BucketArray{1, 1, Overflow::Reservoir};
+      table.insert(0, 0);
+      for(std::size_t n=1; n<100; ++n){
+	table.erase(0, n - 1);
+	table.insert(0, n);
+      }
+      AssertEqual(table.find(0)[0], neuron_t{99});
+
+      table.insert(0, 100);
+      if(table.find(0)[0] == 100){ ++replaced; }
+    }
+    AssertTrue(std::abs(double(replaced) / trials - 0.5) < 0.05);
+  }, "BucketArray reservoir after erase");
+
+  test.Add([](){
+    AssertRaises<std::runtime_error>([](){ BucketArray{32, 4}; }, "too many bits");
+    AssertRaises<std::runtime_error>([](){ BucketArray{4, 0}; }, "zero capacity");
+  }, "BucketArray error");
+
+  test.Add([](){
+    auto map = std::shared_ptr<TableFunc>{new MapTableFunc{}};
+    auto array = std::shared_ptr<TableFunc>{new BucketArrayFunc{4, 8}};
+
+    for(auto& f : {map, array}){
+      auto table = std::unique_ptr<HashTable>{f->GetTable()};
+      table->insert(3, 7);
+      AssertEqual(table->size(), std::size_t{1});
+      AssertEqual(table->find(3).size(), std::size_t{1});
+
+      const auto n = std::numeric_limits<neuron_t>::max();
+      table->insert(5, n);
+      AssertEqual(table->find(5)[0], n);
+
+      table->clear();
+      table->insert(6, 7);
+      AssertEqual(table->find(3).size(), std::size_t{0});
+      AssertEqual(table->find(6).size(), std::size_t{1});
+    }
+  }, "TableFunc");
+
+  test.Add([](){
+    auto c = VoteCounter{5};
+    c.begin();
+    AssertEqual(c.add(3), std::uint32_t{1});
+    AssertEqual(c.add(1), std::uint32_t{1});
+    AssertEqual(c.add(3), std::uint32_t{2});
+    AssertEqual(c.size(), std::size_t{2});
+    AssertEqual(c.votes(3), std::uint32_t{2});
+    AssertEqual(c.votes(0), std::uint32_t{0});
+
+    c.begin();
+    AssertEqual(c.size(), std::size_t{0});
+    AssertFalse(c.contains(3));
+    AssertEqual(c.add(3), std::uint32_t{1});
+
+    c.resize(8);
+    AssertEqual(c.capacity(), std::size_t{8});
+    AssertEqual(c.add(7), std::uint32_t{1});
+  }, "VoteCounter");
+
+  test.Add([](){
+    auto c = VoteCounter{6};
+    c.begin();
+    for(auto n : {5, 4, 2, 4, 2, 1, 0}){ c.add(n); }
+
+    auto top = c.top(3);
+    AssertEqual(std::vector<std::size_t>(top.begin(), top.end()),
+		std::vector<std::size_t>{2, 4, 0});
+    AssertEqual(c.top(10).size(), std::size_t{5});
+  }, "VoteCounter top");
+
+  return test.Run();
+}
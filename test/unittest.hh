@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <iostream>
 #include <cstdlib>
+#include <cmath>
 #include <functional>
 #include <vector>
 #include <string>
@@ -197,6 +198,8 @@ namespace unittest {
 	// epsilon is the difference between 1.0 and the next value.
 	// Relative comparison (|X-Y| < eps      ) is preferred for large value.
 	// Absolute comparison (|X-Y| < eps * |X|) is preferred for small value.
+	// Infinity is equal only to the same infinity.
+	if(std::isinf((LR)lhs) || std::isinf((LR)rhs)){ return (LR)lhs == (LR)rhs; }
 	return abs(lhs - rhs) <= eps * std::max<LR>({one,abs((LR)lhs),abs((LR)rhs)});
       } else {
 	return (LR)lhs == (LR)rhs;